@@ -0,0 +1,124 @@
+// Access patterns that depend on the order of voxels inside chunks. Built once per layout (bench_chunk_layout_linear
+// and bench_chunk_layout_morton), compare the two outputs to pick the layout.
+#include <cmath>
+#include <random>
+#include <benchmark/benchmark.h>
+#include "AssetsRegister.hpp"
+#include "ChunkMesher.hpp"
+#include "VoxelGrid.hpp"
+
+namespace {
+
+constexpr int WIDTH = 128, HEIGHT = 64, DEPTH = 128;
+
+// Rolling terrain of four blocks with scattered caves, so chunks use multi-bit palettes like real worlds do
+const VoxelGrid &Terrain()
+{
+    static const VoxelGrid grid = [] {
+        VoxelGrid grid(WIDTH, HEIGHT, DEPTH);
+        std::mt19937 random(42);
+        for (int x = 0; x < WIDTH; ++x) {
+            for (int z = 0; z < DEPTH; ++z) {
+                const int height = 24 + static_cast<int>(8 * std::sin(x * 0.09) + 6 * std::cos(z * 0.13));
+                grid.fill_box({x, 0, z}, {x, height - 4, z}, {3});
+                grid.fill_box({x, height - 3, z}, {x, height - 1, z}, {2});
+                grid.set(x, height, z, {1});
+            }
+        }
+        for (int i = 0; i < 20000; ++i)
+            grid.set(random() % WIDTH, random() % HEIGHT, random() % DEPTH, {random() % 2 ? 0u : 4u});
+        grid.drain_dirty_chunks();
+        return grid;
+    }();
+    return grid;
+}
+
+void FacesVisibility(benchmark::State &state)
+{
+    // faces_visibility() is not const, the benchmark works on its own copy
+    auto grid = Terrain();
+    for (auto _: state) {
+        unsigned visible = 0;
+        for (int x = 0; x < WIDTH; ++x) {
+            for (int y = 0; y < HEIGHT; ++y) {
+                for (int z = 0; z < DEPTH; ++z)
+                    visible += grid.faces_visibility(x, y, z).count();
+            }
+        }
+        benchmark::DoNotOptimize(visible);
+    }
+    state.SetItemsProcessed(state.iterations() * WIDTH * HEIGHT * DEPTH);
+}
+
+void Raycast(benchmark::State &state)
+{
+    const auto &grid = Terrain();
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(-1, 1);
+    std::vector<glm::vec3> origins(4096), directions(4096);
+    for (std::size_t i = 0; i < origins.size(); ++i) {
+        origins[i] = {(unit(random) + 1) * WIDTH / 2, HEIGHT - 1, (unit(random) + 1) * DEPTH / 2};
+        directions[i] = {unit(random), -std::abs(unit(random)) - 0.1f, unit(random)};
+    }
+    for (auto _: state) {
+        for (std::size_t i = 0; i < origins.size(); ++i)
+            benchmark::DoNotOptimize(grid.raycast(origins[i], directions[i]));
+    }
+    state.SetItemsProcessed(state.iterations() * origins.size());
+}
+
+void MeshGather(benchmark::State &state)
+{
+    const auto &grid = Terrain();
+    AssetsRegister assets;
+    ChunkMesher mesher(assets);
+    for (auto _: state) {
+        for (const auto [chunk_pos, chunk]: grid.non_empty_chunks())
+            mesher.gather(grid, chunk_pos);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * grid.chunk_count());
+}
+
+// Walks every chunk with the given axis innermost, the pattern of face culling along that axis
+void ChunkScan(benchmark::State &state)
+{
+    const auto &grid = Terrain();
+    const int axis = state.range(0);
+    for (auto _: state) {
+        unsigned solid = 0;
+        for (const auto [chunk_pos, chunk]: grid.non_empty_chunks()) {
+            for (int a = 0; a < VoxelGrid::Chunk::SIZE; ++a) {
+                for (int b = 0; b < VoxelGrid::Chunk::SIZE; ++b) {
+                    for (int c = 0; c < VoxelGrid::Chunk::SIZE; ++c) {
+                        const unsigned position[3] = {
+                            unsigned(axis == 0 ? c : a), unsigned(axis == 1 ? c : axis == 0 ? a : b),
+                            unsigned(axis == 2 ? c : b)
+                        };
+                        solid += chunk(position[0], position[1], position[2]).block_id != 0;
+                    }
+                }
+            }
+        }
+        benchmark::DoNotOptimize(solid);
+    }
+    state.SetItemsProcessed(state.iterations() * grid.chunk_count() * VoxelGrid::Chunk::VOLUME);
+}
+
+}
+
+BENCHMARK(FacesVisibility)->Unit(benchmark::kMillisecond);
+BENCHMARK(Raycast)->Unit(benchmark::kMicrosecond);
+BENCHMARK(MeshGather)->Unit(benchmark::kMicrosecond);
+BENCHMARK(ChunkScan)->Arg(0)->Arg(1)->Arg(2)->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char **argv)
+{
+    benchmark::AddCustomContext("chunk_layout", VoxelGrid::Chunk::Layout::NAME);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
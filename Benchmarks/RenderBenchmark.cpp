@@ -0,0 +1,315 @@
+// Renders a fixed world along a scripted camera path into an offscreen EGL pbuffer and prints frame times, draw calls
+// and triangles as JSON. Needs no window system, so it runs on llvmpipe in CI.
+//
+//     bench_render [--frames N] [--warmup N] [--width W] [--height H] [--instanced] [--resources DIR] [--output FILE]
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <GL/glew.h>
+#include <EGL/egl.h>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "AssetsRegister.hpp"
+#include "Frustum.hpp"
+#include "WorldRenderer.hpp"
+#include "GL/GLSL/Types.hpp"
+#include "GL/ShaderBatch.hpp"
+#include "GL/State.hpp"
+#include "GL/UniformBuffer.hpp"
+
+#ifndef YAOGLS_RESOURCE_ROOT
+#define YAOGLS_RESOURCE_ROOT "Resources"
+#endif
+
+namespace {
+
+constexpr int WIDTH = 128, HEIGHT = 64, DEPTH = 128;
+constexpr float FIELD_OF_VIEW = 45.0f;
+
+struct Options
+{
+    unsigned frames = 600;
+    unsigned warmup = 60;
+    int width = 1280;
+    int height = 720;
+    bool instanced = false;
+    std::filesystem::path resource_root = YAOGLS_RESOURCE_ROOT;
+    // Standard output if empty
+    std::filesystem::path output;
+};
+
+Options ParseOptions(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view option = argv[i];
+        if (option == "--instanced") {
+            options.instanced = true;
+            continue;
+        }
+        if (i + 1 == argc)
+            throw GL::Error("option '{}' needs a value", option);
+        const std::string value = argv[++i];
+        if (option == "--frames")
+            options.frames = std::stoul(value);
+        else if (option == "--warmup")
+            options.warmup = std::stoul(value);
+        else if (option == "--width")
+            options.width = std::stoi(value);
+        else if (option == "--height")
+            options.height = std::stoi(value);
+        else if (option == "--resources")
+            options.resource_root = value;
+        else if (option == "--output")
+            options.output = value;
+        else
+            throw GL::Error("unknown option '{}'", option);
+    }
+    if (!options.frames)
+        throw GL::Error("at least one frame has to be rendered");
+    return options;
+}
+
+// Core profile context without any window: a pbuffer surface on the default EGL display
+class OffscreenContext
+{
+    EGLDisplay _display = EGL_NO_DISPLAY;
+    EGLSurface _surface = EGL_NO_SURFACE;
+    EGLContext _context = EGL_NO_CONTEXT;
+
+public:
+    OffscreenContext(int width, int height)
+    {
+        _display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (_display == EGL_NO_DISPLAY || !eglInitialize(_display, nullptr, nullptr))
+            throw GL::Error("unable to initialize EGL");
+        if (!eglBindAPI(EGL_OPENGL_API))
+            throw GL::Error("EGL does not provide desktop OpenGL");
+
+        const EGLint config_attributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+            EGL_DEPTH_SIZE, 24,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint config_count;
+        if (!eglChooseConfig(_display, config_attributes, &config, 1, &config_count) || config_count < 1)
+            throw GL::Error("no EGL config with a pbuffer and desktop OpenGL");
+
+        const EGLint surface_attributes[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+        _surface = eglCreatePbufferSurface(_display, config, surface_attributes);
+        if (_surface == EGL_NO_SURFACE)
+            throw GL::Error("unable to create a {}x{} pbuffer (EGL error {:#x})", width, height, eglGetError());
+
+        const EGLint context_attributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        _context = eglCreateContext(_display, config, EGL_NO_CONTEXT, context_attributes);
+        if (_context == EGL_NO_CONTEXT || !eglMakeCurrent(_display, _surface, _surface, _context))
+            throw GL::Error("unable to create an OpenGL 3.3 core context (EGL error {:#x})", eglGetError());
+
+        glewExperimental = true;
+        // GLEW built for GLX loads the core and extension functions before it fails to find an X display
+        const auto result = glewInit();
+        if (result != GLEW_OK && result != GLEW_ERROR_NO_GLX_DISPLAY)
+            throw GL::Error("unable to initialize GLEW: {}",
+                            reinterpret_cast<const char *>(glewGetErrorString(result)));
+        while (glGetError() != GL_NO_ERROR)
+            continue;
+    }
+
+    OffscreenContext(const OffscreenContext &other) = delete;
+
+    ~OffscreenContext()
+    {
+        eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (_context != EGL_NO_CONTEXT)
+            eglDestroyContext(_display, _context);
+        if (_surface != EGL_NO_SURFACE)
+            eglDestroySurface(_display, _surface);
+        eglTerminate(_display);
+    }
+};
+
+// The terrain of the chunk layout benchmark, seeded the same way so both measure the same world
+void FillTerrain(VoxelGrid &grid)
+{
+    std::mt19937 random(42);
+    for (int x = 0; x < WIDTH; ++x) {
+        for (int z = 0; z < DEPTH; ++z) {
+            const int height = 24 + static_cast<int>(8 * std::sin(x * 0.09) + 6 * std::cos(z * 0.13));
+            grid.fill_box({x, 0, z}, {x, height - 4, z}, {3});
+            grid.fill_box({x, height - 3, z}, {x, height - 1, z}, {2});
+            grid.set(x, height, z, {1});
+        }
+    }
+    for (int i = 0; i < 20000; ++i)
+        grid.set(random() % WIDTH, random() % HEIGHT, random() % DEPTH, {random() % 2 ? 0u : 4u});
+    grid.drain_dirty_chunks();
+}
+
+// One lap around the world with the camera rising and sinking twice, looking slightly ahead of the centre so that
+// both near chunks and the far edge of the world are in view
+glm::mat4 CameraPath(float t, glm::vec3 &position)
+{
+    const float angle = 2 * glm::pi<float>() * t;
+    const glm::vec3 centre(WIDTH / 2.0f, 24, DEPTH / 2.0f);
+    position = centre + glm::vec3(56 * std::cos(angle), 16 + 12 * std::sin(2 * angle), 56 * std::sin(angle));
+    const glm::vec3 target = centre + glm::vec3(16 * std::cos(angle + 1), 0, 16 * std::sin(angle + 1));
+    return glm::lookAt(position, target, glm::vec3(0, 1, 0));
+}
+
+void SubmitProgram(GL::ShaderBatch &batch, GL::ShaderProgram &program, const std::filesystem::path &shaders_path,
+                   const char *vertex_file, const char *fragment_file)
+{
+    std::vector<GL::Shader> shaders;
+    GL::VertexShader vertex_shader(vertex_file);
+    vertex_shader.add_source(shaders_path / vertex_file);
+    shaders.push_back(std::move(vertex_shader));
+    GL::FragmentShader fragment_shader(fragment_file);
+    fragment_shader.add_source(shaders_path / fragment_file);
+    shaders.push_back(std::move(fragment_shader));
+    batch.add(program, std::move(shaders), [](GL::ShaderProgram &linked) {
+        linked.bind_uniform_block(GL::GLSL::Camera::BLOCK_NAME, GL::GLSL::Camera::BINDING);
+    });
+}
+
+// Value at fraction q of the sorted values, by the nearest rank
+template<class T>
+T Percentile(const std::vector<T> &sorted, double q)
+{
+    const auto rank = static_cast<std::size_t>(std::ceil(q * sorted.size()));
+    return sorted[std::clamp<std::size_t>(rank, 1, sorted.size()) - 1];
+}
+
+struct Results
+{
+    std::vector<double> frame_ms;
+    std::vector<unsigned> draw_calls;
+    std::vector<std::uint64_t> triangles;
+};
+
+void WriteResults(std::ostream &out, const Options &options, const Results &results)
+{
+    auto frame_ms = results.frame_ms;
+    std::sort(frame_ms.begin(), frame_ms.end());
+    double total_ms = 0;
+    for (auto ms: frame_ms)
+        total_ms += ms;
+    std::uint64_t total_draw_calls = 0, total_triangles = 0;
+    for (auto calls: results.draw_calls)
+        total_draw_calls += calls;
+    for (auto triangles: results.triangles)
+        total_triangles += triangles;
+    const auto frames = frame_ms.size();
+
+    out << "{\n";
+    out << fmt::format(R"(  "renderer": "{}",)" "\n", reinterpret_cast<const char *>(glGetString(GL_RENDERER)));
+    out << fmt::format(R"(  "version": "{}",)" "\n", reinterpret_cast<const char *>(glGetString(GL_VERSION)));
+    out << fmt::format(R"(  "width": {}, "height": {}, "frames": {}, "warmup": {}, "instanced": {},)" "\n",
+                       options.width, options.height, frames, options.warmup, options.instanced);
+    out << fmt::format(R"(  "frame_ms": {{"min": {:.4f}, "avg": {:.4f}, "p50": {:.4f}, "p90": {:.4f}, "p99": {:.4f}, )"
+                       R"("max": {:.4f}}},)" "\n",
+                       frame_ms.front(), total_ms / frames, Percentile(frame_ms, 0.5), Percentile(frame_ms, 0.9),
+                       Percentile(frame_ms, 0.99), frame_ms.back());
+    out << fmt::format(R"(  "draw_calls": {{"avg": {:.2f}, "max": {}}},)" "\n", double(total_draw_calls) / frames,
+                       *std::max_element(results.draw_calls.begin(), results.draw_calls.end()));
+    out << fmt::format(R"(  "triangles": {{"avg": {:.1f}, "max": {}}})" "\n", double(total_triangles) / frames,
+                       *std::max_element(results.triangles.begin(), results.triangles.end()));
+    out << "}\n";
+}
+
+int Run(const Options &options)
+{
+    OffscreenContext context(options.width, options.height);
+    glViewport(0, 0, options.width, options.height);
+
+    VoxelGrid grid(WIDTH, HEIGHT, DEPTH);
+    FillTerrain(grid);
+    AssetsRegister assets;
+    assets.read_pack(options.resource_root / "AssetsPack" / "MANIFEST.yml");
+
+    GL::ShaderProgram voxel_shader, occlusion_shader;
+    GL::ShaderBatch batch;
+    const auto shaders_path = options.resource_root / "Shaders";
+    SubmitProgram(batch, voxel_shader, shaders_path, options.instanced ? "VoxelInstanced.vert" : "Voxel.vert",
+                  "Voxel.frag");
+    SubmitProgram(batch, occlusion_shader, shaders_path, "OcclusionBox.vert", "OcclusionBox.frag");
+    batch.finish();
+
+    // Without a job system every update() meshes synchronously, so the work per frame does not depend on timing
+    WorldRenderer renderer(grid);
+    renderer.set_instanced(options.instanced);
+    renderer.set_occlusion_culling(true);
+    const auto ratio = float(options.width) / float(options.height);
+    const auto projection = glm::perspective(glm::radians(FIELD_OF_VIEW), ratio, 0.1f, 500.0f);
+    renderer.set_lod_focal_length(options.height / (2 * std::tan(glm::radians(FIELD_OF_VIEW) / 2)));
+
+    GL::UniformBuffer<GL::GLSL::Camera> camera_uniforms(GL::GLSL::Camera::BINDING);
+    auto &state = GL::State::Current();
+    state.set_capability(GL_DEPTH_TEST, true);
+    state.set_capability(GL_CULL_FACE, true);
+    glClearColor(0, 0, 0, 0);
+
+    Results results;
+    const auto total_frames = options.warmup + options.frames;
+    for (unsigned frame = 0; frame < total_frames; ++frame) {
+        const auto start = std::chrono::steady_clock::now();
+        glm::vec3 position;
+        const auto view = CameraPath(float(frame) / total_frames, position);
+        renderer.update(assets, position);
+        camera_uniforms.update({view, projection});
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        state.use_program(voxel_shader.id());
+        renderer.draw(voxel_shader, assets, Frustum(projection * view));
+        state.use_program(occlusion_shader.id());
+        renderer.draw_occlusion_queries(occlusion_shader);
+        // There is no swap to pace the frames, finishing makes the time cover the GPU work
+        glFinish();
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (frame < options.warmup)
+            continue;
+        results.frame_ms.push_back(elapsed.count());
+        results.draw_calls.push_back(renderer.draw_calls());
+        results.triangles.push_back(renderer.triangles());
+    }
+    GL::GLError::RaiseIfError();
+
+    if (options.output.empty()) {
+        WriteResults(std::cout, options, results);
+    } else {
+        std::ofstream out(options.output);
+        WriteResults(out, options, results);
+        if (!out)
+            throw GL::Error("unable to write '{}'", options.output.string());
+    }
+    renderer.release();
+    camera_uniforms.release();
+    return 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    try {
+        return Run(ParseOptions(argc, argv));
+    } catch (GL::ShaderCompilationError &e) {
+        std::cerr << e.what() << ": " << e.message() << "\n" << e.compilation_log() << std::endl;
+    } catch (GL::Error &e) {
+        std::cerr << e.what() << ": " << e.message() << std::endl;
+    } catch (std::exception &e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+    }
+    return 1;
+}
@@ -1,7 +1,27 @@
 #version 330
 
-in vec3 color;
+in vec2 world_xz;
+out vec4 out_colour;
+
+// Five lines across every voxel cell, leaving a small gap at the cell borders
+const float FIRST_LINE = 0.02;
+const float LINE_SPACING = 0.24;
+
+float LineCoverage(float across, float along)
+{
+    float cell = fract(across);
+    float nearest = FIRST_LINE + LINE_SPACING * clamp(round((cell - FIRST_LINE) / LINE_SPACING), 0.0, 4.0);
+    // Derivatives give the size of a pixel, so lines stay one pixel wide at any distance
+    float pixel = fwidth(across);
+    float coverage = 1.0 - clamp(abs(cell - nearest) / pixel, 0.0, 1.0);
+    float inside = step(FIRST_LINE, fract(along)) * step(fract(along), 1.0 - FIRST_LINE);
+    // Lines closer together than a few pixels fade out instead of turning into moire
+    return coverage * inside * clamp(2.0 - 4.0 * pixel / LINE_SPACING, 0.0, 1.0);
+}
 
 void main() {
-    gl_FragColor = vec4(color, 1);
+    float coverage = max(LineCoverage(world_xz.x, world_xz.y), LineCoverage(world_xz.y, world_xz.x));
+    if (coverage <= 0.0)
+        discard;
+    out_colour = vec4(vec3(0.5), coverage);
 }
@@ -1,21 +1,20 @@
 #version 330
 
-layout(location = 0) in vec2 position;
+// Rectangle under the whole grid drawn as a triangle strip of four vertices, without any vertex buffer
+out vec2 world_xz;
 
-out vec3 color;
-
-uniform vec3 Position;
-uniform mat4 ViewMatrix;
-uniform mat4 ProjectionMatrix;
+uniform vec3 FloorMin;
+uniform vec2 FloorMax;
+// Written once per frame and shared by all programs drawing the world
+layout(std140) uniform Camera
+{
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+};
 
 void main()
 {
-    vec4 wspos;
-    wspos.x = 0.48 * position.x + 0.5;
-    wspos.y = 0.05;
-    wspos.z = 0.48 * position.y + 0.5;
-    wspos.w = 1;
-    wspos.xyz += Position;
-    gl_Position = ProjectionMatrix * ViewMatrix * wspos;
-    color = vec3(0.5);
+    vec2 corner = vec2(gl_VertexID >> 1, gl_VertexID & 1);
+    world_xz = mix(FloorMin.xz, FloorMax, corner);
+    gl_Position = ProjectionMatrix * ViewMatrix * vec4(world_xz.x, FloorMin.y + 0.05, world_xz.y, 1);
 }
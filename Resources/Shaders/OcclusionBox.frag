@@ -0,0 +1,10 @@
+#version 330 core
+
+out vec4 out_colour;
+
+
+void main()
+{
+    // Colour writes are masked, only the samples passing the depth test are counted
+    out_colour = vec4(1.0);
+}
@@ -0,0 +1,21 @@
+#version 330 core
+
+// Unit cube in the packed format of Voxel.vert
+layout(location = 0) in uvec2 in_vertex;
+
+uniform vec3 BoxPosition;
+uniform vec3 BoxSize;
+
+// Written once per frame and shared by all programs drawing the world
+layout(std140) uniform Camera
+{
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+};
+
+
+void main()
+{
+    vec3 position = vec3(in_vertex.x & 1u, (in_vertex.x >> 5) & 1u, (in_vertex.x >> 10) & 1u);
+    gl_Position = ProjectionMatrix * ViewMatrix * vec4(BoxPosition + position * BoxSize, 1);
+}
@@ -1,21 +1,33 @@
 #version 330 core
 
-layout(location = 0) in vec3 in_position;
-layout(location = 1) in int in_face_id;
-layout(location = 2) in vec2 in_texcoord;
+const int MATERIAL_STRIDE = 8;
+const uint POSITION_MASK = 31u;
+
+// Position (5 bits per axis), face (3 bits) and texture coordinates (5 bits each), then the block id and the chunk
+// slot (16 bits each)
+layout(location = 0) in uvec2 in_vertex;
 flat out int face_id;
+flat out int texture_layer;
 out vec2 texcoord;
 
-uniform vec3 Position;
+uniform isamplerBuffer ChunkOrigins;
+uniform isamplerBuffer MaterialTable;
 
-uniform mat4 ModelMatrix;
-uniform mat4 ViewMatrix;
-uniform mat4 ProjectionMatrix;
+// Written once per frame and shared by all programs drawing the world
+layout(std140) uniform Camera
+{
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+};
 
 
 void main()
 {
-    gl_Position =  ProjectionMatrix * ViewMatrix * (ModelMatrix * vec4(in_position, 1) + vec4(Position, 0));
-    face_id = in_face_id;
-    texcoord = in_texcoord;
+    vec3 position = vec3(in_vertex.x & POSITION_MASK, (in_vertex.x >> 5) & POSITION_MASK,
+                         (in_vertex.x >> 10) & POSITION_MASK);
+    face_id = int((in_vertex.x >> 15) & 7u);
+    texcoord = vec2((in_vertex.x >> 18) & POSITION_MASK, (in_vertex.x >> 23) & POSITION_MASK);
+    vec3 origin = vec3(texelFetch(ChunkOrigins, int(in_vertex.y >> 16)).xyz);
+    gl_Position =  ProjectionMatrix * ViewMatrix * vec4(position + origin, 1);
+    texture_layer = texelFetch(MaterialTable, int(in_vertex.y & 0xFFFFu) * MATERIAL_STRIDE + face_id).r;
 }
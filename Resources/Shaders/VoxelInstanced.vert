@@ -0,0 +1,40 @@
+#version 330 core
+
+const int MATERIAL_STRIDE = 8;
+const uint POSITION_MASK = 31u;
+
+// Unit cube in the packed format of Voxel.vert, its block id is unused
+layout(location = 0) in uvec2 in_vertex;
+layout(location = 4) in vec3 in_instance_position;
+layout(location = 5) in int in_block_id;
+layout(location = 6) in int in_face_mask;
+flat out int face_id;
+flat out int texture_layer;
+out vec2 texcoord;
+
+uniform vec3 Position;
+uniform isamplerBuffer MaterialTable;
+
+// Written once per frame and shared by all programs drawing the world
+layout(std140) uniform Camera
+{
+    mat4 ViewMatrix;
+    mat4 ProjectionMatrix;
+};
+
+
+void main()
+{
+    int face = int((in_vertex.x >> 15) & 7u);
+    // Faces covered by a neighbour collapse into a point outside of the clip volume
+    if ((in_face_mask & (1 << face)) == 0) {
+        gl_Position = vec4(2, 2, 2, 1);
+        return;
+    }
+    vec3 position = vec3(in_vertex.x & POSITION_MASK, (in_vertex.x >> 5) & POSITION_MASK,
+                         (in_vertex.x >> 10) & POSITION_MASK);
+    gl_Position =  ProjectionMatrix * ViewMatrix * vec4(position + in_instance_position + Position, 1);
+    face_id = face;
+    texture_layer = texelFetch(MaterialTable, in_block_id * MATERIAL_STRIDE + face).r;
+    texcoord = vec2((in_vertex.x >> 18) & POSITION_MASK, (in_vertex.x >> 23) & POSITION_MASK);
+}
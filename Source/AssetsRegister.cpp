@@ -2,6 +2,7 @@
 #include <GL/glew.h>
 #include "AssetsRegister.hpp"
 #include "GL/Misc.hpp"
+#include "GL/State.hpp"
 
 
 void AssetsRegister::read_pack(const std::filesystem::path &manifest_path)
@@ -23,7 +24,7 @@ void AssetsRegister::read_pack(const std::filesystem::path &manifest_path)
             atlas.image.read(root_path / pack_object["file"].as<std::string>());
 
             glGenTextures(1, &atlas.block_texture_array);
-            glBindTexture(GL_TEXTURE_2D_ARRAY, atlas.block_texture_array);
+            GL::State::Current().bind_texture(0, GL_TEXTURE_2D_ARRAY, atlas.block_texture_array);
             // fixme: proper layer count
             glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGB8, static_cast<GLsizei>(atlas.resolution),
                            static_cast<GLsizei>(atlas.resolution), 256);
@@ -37,6 +38,8 @@ void AssetsRegister::read_pack(const std::filesystem::path &manifest_path)
             const auto reg_data = YAML::LoadFile(root_path / pack_object["file"].as<std::string>());
             auto &used_atlas = atlases_.at(reg_data["textures_source"].as<std::string>());
             for (const auto &block: reg_data["blocks"]) {
+                if (registered_blocks_.size() >= MAX_BLOCKS)
+                    throw GL::Error("Cannot register more than {} blocks", MAX_BLOCKS);
                 std::unique_ptr<BlockModel> model = std::make_unique<BlockModel>();
                 model->id_ = registered_blocks_.size() + 1;
                 model->name_ = block["name"].as<std::string>();
@@ -58,6 +61,27 @@ void AssetsRegister::read_pack(const std::filesystem::path &manifest_path)
             }
         }
     }
+    upload_materials_();
+}
+
+void AssetsRegister::upload_materials_()
+{
+    std::vector<GLint> table(MATERIAL_STRIDE * (registered_blocks_.size() + 1), 0);
+    for (const auto &block: registered_blocks_) {
+        const auto &layers = block->faces_textures_indices();
+        std::copy(layers.begin(), layers.end(), table.begin() + MATERIAL_STRIDE * block->id_);
+    }
+
+    if (!material_buffer_) {
+        glGenBuffers(1, &material_buffer_);
+        glGenTextures(1, &material_table_);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, material_buffer_);
+    glBufferData(GL_TEXTURE_BUFFER, table.size() * sizeof(GLint), table.data(), GL_STATIC_DRAW);
+    GL::State::Current().bind_texture(0, GL_TEXTURE_BUFFER, material_table_);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, material_buffer_);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    GL::GLError::RaiseIfError();
 }
 
 GLuint AssetsRegister::get_texture_index_(AssetsRegister::TextureAtlas_ &source, const size_t x, const size_t y)
@@ -85,7 +109,7 @@ GLuint AssetsRegister::get_texture_index_(AssetsRegister::TextureAtlas_ &source,
 
     // Upload pixels to GPU
     const auto index = static_cast<GLsizei>(source.loaded_textures.size());
-    glBindTexture(GL_TEXTURE_2D_ARRAY, source.block_texture_array);
+    GL::State::Current().bind_texture(0, GL_TEXTURE_2D_ARRAY, source.block_texture_array);
     glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, index,
                     static_cast<GLsizei>(source.resolution), static_cast<GLsizei>(source.resolution), 1,
                     GL_RGB, GL_UNSIGNED_BYTE, tile_rgb.data());
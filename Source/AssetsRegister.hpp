@@ -1,5 +1,7 @@
 #pragma once
+#include <array>
 #include <filesystem>
+#include <memory>
 #include <string>
 #include <map>
 #include <vector>
@@ -20,12 +22,23 @@ class AssetsRegister
 
     std::map<std::string, TextureAtlas_> atlases_;
     std::vector<std::unique_ptr<class BlockModel>> registered_blocks_;
+    GLuint material_buffer_ = 0, material_table_ = 0;
 
     GLuint get_texture_index_(TextureAtlas_ &source, size_t x, size_t y);
+    void upload_materials_();
 
 public:
+    // Ints per block in the material table: the texture layers of the six faces, then two reserved for later use
+    static constexpr GLint MATERIAL_STRIDE = 8;
+    // Block ids are stored in 16 bits of chunk mesh vertices
+    static constexpr size_t MAX_BLOCKS = 0xFFFF;
+
     void read_pack(const std::filesystem::path &manifest_path);
 
+    // Buffer texture (GL_R32I) with MATERIAL_STRIDE ints for every block id, starting with the air block 0
+    GLuint material_table() const noexcept
+    { return material_table_; }
+
     const BlockModel &block_by_id(uint32_t id) const
     { return *registered_blocks_.at(id - 1); }
 };
@@ -0,0 +1,59 @@
+#ifndef OPENGLTUTORIAL_CHUNKLAYOUT_HPP
+#define OPENGLTUTORIAL_CHUNKLAYOUT_HPP
+
+#include <array>
+#include <cstdint>
+
+
+// Orders of voxels inside a chunk with 2^SIZE_LOG2 voxels along each axis. Offset() maps local coordinates to the
+// position of the voxel in chunk storage; with CONTIGUOUS_ROWS voxels differing only in z are stored next to each
+// other.
+
+// x major, z minor: neighbours along z are adjacent, along x they are a whole slice apart
+template<int SIZE_LOG2>
+struct LinearChunkLayout
+{
+    static constexpr std::uint32_t ID = 0;
+    static constexpr const char *NAME = "linear";
+    static constexpr bool CONTIGUOUS_ROWS = true;
+
+    static unsigned Offset(unsigned x, unsigned y, unsigned z) noexcept
+    { return (((x << SIZE_LOG2) | y) << SIZE_LOG2) | z; }
+};
+
+// Z-order curve: bits of x, y and z interleaved, so every aligned cube of 2^k voxels is stored contiguously and
+// neighbours along any axis are close to each other
+template<int SIZE_LOG2>
+struct MortonChunkLayout
+{
+    static constexpr std::uint32_t ID = 1;
+    static constexpr const char *NAME = "morton";
+    static constexpr bool CONTIGUOUS_ROWS = false;
+
+private:
+    // Bit i of a coordinate moved to bit 3i
+    static constexpr auto SPREAD = [] {
+        std::array<unsigned, 1 << SIZE_LOG2> spread{};
+        for (unsigned value = 0; value < spread.size(); ++value) {
+            for (int bit = 0; bit < SIZE_LOG2; ++bit)
+                spread[value] |= ((value >> bit) & 1) << (3 * bit);
+        }
+        return spread;
+    }();
+
+public:
+    static unsigned Offset(unsigned x, unsigned y, unsigned z) noexcept
+    { return (SPREAD[x] << 2) | (SPREAD[y] << 1) | SPREAD[z]; }
+};
+
+// Selected at compile time with the YAOGLS_MORTON_CHUNKS definition (CMake option of the same name)
+#ifdef YAOGLS_MORTON_CHUNKS
+template<int SIZE_LOG2>
+using ChunkLayout = MortonChunkLayout<SIZE_LOG2>;
+#else
+template<int SIZE_LOG2>
+using ChunkLayout = LinearChunkLayout<SIZE_LOG2>;
+#endif
+
+
+#endif //OPENGLTUTORIAL_CHUNKLAYOUT_HPP
@@ -0,0 +1,157 @@
+#ifndef OPENGLTUTORIAL_CHUNKMAP_HPP
+#define OPENGLTUTORIAL_CHUNKMAP_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <glm/vec3.hpp>
+
+
+// Open-addressing hash map from integer chunk coordinates to chunks. Collisions are resolved by linear probing and
+// erasing shifts the following entries back, so there are no tombstones and lookups never degrade over time.
+template<class Value>
+class ChunkMap
+{
+    struct Slot
+    {
+        glm::ivec3 key;
+        bool used = false;
+        Value value;
+    };
+
+    static constexpr std::size_t MIN_CAPACITY = 64;
+
+    std::vector<Slot> _slots;
+    std::size_t _size = 0;
+
+    std::size_t _mask() const noexcept
+    { return _slots.size() - 1; }
+
+    std::size_t _home(glm::ivec3 key) const noexcept
+    {
+        auto h = static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.x)) * 0x9E3779B97F4A7C15ull;
+        h ^= static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.y)) * 0xC2B2AE3D27D4EB4Full;
+        h ^= static_cast<std::uint64_t>(static_cast<std::uint32_t>(key.z)) * 0x165667B19E3779F9ull;
+        return static_cast<std::size_t>(h ^ (h >> 29)) & _mask();
+    }
+
+    std::size_t _find_slot(glm::ivec3 key) const noexcept
+    {
+        for (auto i = _home(key);; i = (i + 1) & _mask()) {
+            if (!_slots[i].used || _slots[i].key == key)
+                return i;
+        }
+    }
+
+    void _rehash(std::size_t capacity)
+    {
+        auto old_slots = std::move(_slots);
+        _slots = std::vector<Slot>(capacity);
+        for (auto &slot: old_slots) {
+            if (!slot.used)
+                continue;
+            auto &target = _slots[_find_slot(slot.key)];
+            target.key = slot.key;
+            target.used = true;
+            target.value = std::move(slot.value);
+        }
+    }
+
+public:
+    std::size_t size() const noexcept
+    { return _size; }
+
+    bool empty() const noexcept
+    { return _size == 0; }
+
+    std::size_t capacity() const noexcept
+    { return _slots.size(); }
+
+    Value *find(glm::ivec3 key) noexcept
+    {
+        if (_slots.empty())
+            return nullptr;
+        auto &slot = _slots[_find_slot(key)];
+        return slot.used ? &slot.value : nullptr;
+    }
+
+    const Value *find(glm::ivec3 key) const noexcept
+    { return const_cast<ChunkMap *>(this)->find(key); }
+
+    // Returns the value stored under the key, default-constructing it first if it is missing
+    Value &operator[](glm::ivec3 key)
+    {
+        // Keep the load factor at most 1/2
+        if (2 * (_size + 1) > _slots.size())
+            _rehash(std::max(MIN_CAPACITY, 2 * _slots.size()));
+        auto &slot = _slots[_find_slot(key)];
+        if (!slot.used) {
+            slot.key = key;
+            slot.used = true;
+            slot.value = Value();
+            ++_size;
+        }
+        return slot.value;
+    }
+
+    bool erase(glm::ivec3 key)
+    {
+        if (_slots.empty())
+            return false;
+        auto hole = _find_slot(key);
+        if (!_slots[hole].used)
+            return false;
+
+        // Move back every following entry of the cluster which would no longer be reachable from its home slot
+        for (auto i = (hole + 1) & _mask(); _slots[i].used; i = (i + 1) & _mask()) {
+            const auto home = _home(_slots[i].key);
+            const bool reachable = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+            if (reachable)
+                continue;
+            _slots[hole].key = _slots[i].key;
+            _slots[hole].value = std::move(_slots[i].value);
+            hole = i;
+        }
+        _slots[hole].used = false;
+        _slots[hole].value = Value();
+        --_size;
+        return true;
+    }
+
+    void clear()
+    {
+        _slots.clear();
+        _size = 0;
+    }
+
+    // Returns the value in the given slot (in [0, capacity())) and its key, or nullptr if the slot is unused
+    const Value *slot(std::size_t index, glm::ivec3 &key) const noexcept
+    {
+        if (!_slots[index].used)
+            return nullptr;
+        key = _slots[index].key;
+        return &_slots[index].value;
+    }
+
+    template<class Function>
+    void for_each(Function &&function)
+    {
+        for (auto &slot: _slots) {
+            if (slot.used)
+                function(slot.key, slot.value);
+        }
+    }
+
+    template<class Function>
+    void for_each(Function &&function) const
+    {
+        for (const auto &slot: _slots) {
+            if (slot.used)
+                function(slot.key, slot.value);
+        }
+    }
+};
+
+
+#endif //OPENGLTUTORIAL_CHUNKMAP_HPP
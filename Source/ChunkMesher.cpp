@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <map>
+#include "ChunkMesher.hpp"
+#include "AssetsRegister.hpp"
+
+namespace {
+
+// Faces are numbered like VoxelFace: BACK (-z), FRONT (+z), LEFT (-x), RIGHT (+x), BOTTOM (-y), TOP (+y)
+constexpr int FACE_AXIS[6] = {2, 2, 0, 0, 1, 1};
+constexpr int FACE_U_AXIS[6] = {0, 0, 2, 2, 0, 0};
+constexpr int FACE_V_AXIS[6] = {1, 1, 1, 1, 2, 2};
+constexpr int FACE_DIRECTION[6][3] = {{0, 0, -1}, {0, 0, 1}, {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}};
+
+// For each face: which end of the quad's box every corner takes on each axis, ordered so that the corners 0, 1, 2
+// and 2, 1, 3 are counter-clockwise when looking at the face from outside
+constexpr int FACE_CORNERS[6][4][3] = {
+    {{1, 0, 0}, {0, 0, 0}, {1, 1, 0}, {0, 1, 0}},
+    {{0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {1, 1, 0}},
+    {{0, 0, 0}, {0, 0, 1}, {0, 1, 0}, {0, 1, 1}},
+    {{0, 0, 1}, {0, 0, 0}, {0, 1, 1}, {0, 1, 0}},
+    {{0, 0, 0}, {1, 0, 0}, {0, 0, 1}, {1, 0, 1}},
+    {{0, 0, 1}, {1, 0, 1}, {0, 0, 0}, {1, 0, 0}},
+};
+
+// Most common block id among the votes. Ties go to blocks rather than to air, so that surfaces do not sink at coarser
+// levels.
+class Ballot
+{
+    std::vector<std::pair<unsigned, int>> _votes;
+
+public:
+    void clear() noexcept
+    { _votes.clear(); }
+
+    void add(unsigned block_id)
+    {
+        auto it = std::find_if(_votes.begin(), _votes.end(), [&](const auto &vote) {
+            return vote.first == block_id;
+        });
+        if (it == _votes.end())
+            _votes.emplace_back(block_id, 1);
+        else
+            ++it->second;
+    }
+
+    unsigned winner() const
+    {
+        auto winner = _votes.front();
+        for (const auto &vote: _votes) {
+            if (vote.second > winner.second || (vote.second == winner.second && winner.first == 0))
+                winner = vote;
+        }
+        return winner.first;
+    }
+};
+
+struct Quad
+{
+    int lo[3], hi[3];
+    int face;
+    GLint block_id;
+};
+
+// Corners are computed and packed without branches, so the compiler can vectorize the loop over the four vertices
+void EmitQuad(const Quad &quad, ChunkMesh &mesh)
+{
+    const auto base = static_cast<GLuint>(mesh.vertices.size());
+    const int u_size = quad.hi[FACE_U_AXIS[quad.face]] - quad.lo[FACE_U_AXIS[quad.face]];
+    const int v_size = quad.hi[FACE_V_AXIS[quad.face]] - quad.lo[FACE_V_AXIS[quad.face]];
+    const int tex_u[4] = {0, u_size, 0, u_size};
+    const int tex_v[4] = {v_size, v_size, 0, 0};
+
+    ChunkMesh::Vertex vertices[4];
+    for (int i = 0; i < 4; ++i) {
+        const auto &corner = FACE_CORNERS[quad.face][i];
+        glm::ivec3 position;
+        for (int axis = 0; axis < 3; ++axis)
+            position[axis] = quad.lo[axis] + corner[axis] * (quad.hi[axis] - quad.lo[axis]);
+        vertices[i] = ChunkMesh::Vertex::Pack(position, quad.face, {tex_u[i], tex_v[i]},
+                                              static_cast<GLushort>(quad.block_id));
+    }
+    mesh.vertices.insert(mesh.vertices.end(), std::begin(vertices), std::end(vertices));
+    for (auto i: {0, 1, 2, 2, 1, 3})
+        mesh.indices.push_back(base + i);
+}
+
+}
+
+
+ChunkMesher::ChunkMesher(const AssetsRegister &assets, bool greedy) :
+    _assets(assets),
+    _greedy(greedy),
+    _volume(PADDED_SIZE * PADDED_SIZE * PADDED_SIZE)
+{}
+
+void ChunkMesher::gather(const VoxelGrid &grid, glm::ivec3 chunk_pos)
+{
+    const auto chunk = grid.find_chunk(chunk_pos);
+    const auto origin = grid.chunk_origin(chunk_pos);
+    auto *out = _volume.data();
+    for (int x = -1; x <= SIZE; ++x) {
+        for (int y = -1; y <= SIZE; ++y) {
+            for (int z = -1; z <= SIZE; ++z) {
+                if (0 <= x && x < SIZE && 0 <= y && y < SIZE && 0 <= z && z < SIZE) {
+                    *out++ = chunk ? (*chunk)(x, y, z).block_id : 0;
+                } else {
+                    *out++ = grid(origin.x + x, origin.y + y, origin.z + z).block_id;
+                }
+            }
+        }
+    }
+}
+
+unsigned ChunkMesher::_border_cell(int face, int lod, int a, int b) const
+{
+    const int scale = 1 << lod;
+    const int axis = FACE_AXIS[face];
+    Ballot ballot;
+    int p[3];
+    p[axis] = face & 1 ? SIZE : -1;
+    for (int da = 0; da < scale; ++da) {
+        for (int db = 0; db < scale; ++db) {
+            p[(axis + 1) % 3] = a * scale + da;
+            p[(axis + 2) % 3] = b * scale + db;
+            ballot.add(_at(p[0], p[1], p[2]));
+        }
+    }
+    return ballot.winner();
+}
+
+std::vector<unsigned> ChunkMesher::_downsample(int lod) const
+{
+    const int scale = 1 << lod, size = SIZE >> lod, padded = size + 2;
+    const auto cell = [padded](int x, int y, int z) {
+        return ((x + 1) * padded + (y + 1)) * padded + (z + 1);
+    };
+    // Edges and corners of the padding are never looked at
+    std::vector<unsigned> cells(padded * padded * padded, 0);
+    Ballot ballot;
+    for (int x = 0; x < size; ++x) {
+        for (int y = 0; y < size; ++y) {
+            for (int z = 0; z < size; ++z) {
+                ballot.clear();
+                for (int dx = 0; dx < scale; ++dx) {
+                    for (int dy = 0; dy < scale; ++dy) {
+                        for (int dz = 0; dz < scale; ++dz)
+                            ballot.add(_at(x * scale + dx, y * scale + dy, z * scale + dz));
+                    }
+                }
+                cells[cell(x, y, z)] = ballot.winner();
+            }
+        }
+    }
+    for (int face = 0; face < 6; ++face) {
+        const int axis = FACE_AXIS[face];
+        int p[3];
+        p[axis] = face & 1 ? size : -1;
+        for (int a = 0; a < size; ++a) {
+            for (int b = 0; b < size; ++b) {
+                p[(axis + 1) % 3] = a;
+                p[(axis + 2) % 3] = b;
+                cells[cell(p[0], p[1], p[2])] = _border_cell(face, lod, a, b);
+            }
+        }
+    }
+    return cells;
+}
+
+ChunkMesh ChunkMesher::build(int lod, const NeighbourLods &neighbour_lods) const
+{
+    const int scale = 1 << lod, size = SIZE >> lod, padded = size + 2;
+    std::vector<unsigned> cells;
+    if (lod > 0)
+        cells = _downsample(lod);
+    const auto *volume = lod > 0 ? cells.data() : _volume.data();
+    const auto at = [volume, padded](int x, int y, int z) {
+        return volume[((x + 1) * padded + (y + 1)) * padded + (z + 1)];
+    };
+
+    // Whether any cell of a neighbour at another level in front of border cell (a, b) is air
+    std::vector<bool> border_open;
+    const auto update_border = [&](int face) {
+        border_open.clear();
+        const int neighbour_lod = neighbour_lods[face];
+        if (neighbour_lod < 0 || neighbour_lod == lod)
+            return;
+        const int neighbour_size = SIZE >> neighbour_lod;
+        std::vector<bool> air(neighbour_size * neighbour_size);
+        for (int a = 0; a < neighbour_size; ++a) {
+            for (int b = 0; b < neighbour_size; ++b)
+                air[a * neighbour_size + b] = _border_cell(face, neighbour_lod, a, b) == 0;
+        }
+        border_open.assign(size * size, false);
+        for (int a = 0; a < size; ++a) {
+            for (int b = 0; b < size; ++b) {
+                for (int na = a * scale >> neighbour_lod; na <= ((a + 1) * scale - 1) >> neighbour_lod; ++na) {
+                    for (int nb = b * scale >> neighbour_lod; nb <= ((b + 1) * scale - 1) >> neighbour_lod; ++nb) {
+                        if (air[na * neighbour_size + nb])
+                            border_open[a * size + b] = true;
+                    }
+                }
+            }
+        }
+    };
+
+    // Quads are grouped by texture array, so that every group becomes one draw call
+    std::map<GLuint, std::vector<Quad>> quads;
+    std::uint64_t mask[SIZE][SIZE];
+
+    for (int face = 0; face < 6; ++face) {
+        const int axis = FACE_AXIS[face];
+        const int a_axis = (axis + 1) % 3;
+        const int b_axis = (axis + 2) % 3;
+        const auto &dir = FACE_DIRECTION[face];
+        const int border_slice = face & 1 ? size - 1 : 0;
+        update_border(face);
+
+        for (int slice = 0; slice < size; ++slice) {
+            const bool at_border = slice == border_slice && !border_open.empty();
+            // Mask of exposed faces in this slice; the key is (texture array, block id) or 0 for no face
+            for (int a = 0; a < size; ++a) {
+                for (int b = 0; b < size; ++b) {
+                    int p[3];
+                    p[axis] = slice;
+                    p[a_axis] = a;
+                    p[b_axis] = b;
+                    const auto block_id = at(p[0], p[1], p[2]);
+                    const bool open = at_border ? border_open[a * size + b]
+                                                : at(p[0] + dir[0], p[1] + dir[1], p[2] + dir[2]) == 0;
+                    if (block_id == 0 || !open) {
+                        mask[a][b] = 0;
+                        continue;
+                    }
+                    const auto &model = _assets.block_by_id(block_id);
+                    mask[a][b] = (static_cast<std::uint64_t>(model.used_texture_array_id()) << 32) | block_id;
+                }
+            }
+
+            for (int a = 0; a < size; ++a) {
+                for (int b = 0; b < size; ++b) {
+                    const auto key = mask[a][b];
+                    if (key == 0)
+                        continue;
+
+                    int b_size = 1, a_size = 1;
+                    if (_greedy) {
+                        while (b + b_size < size && mask[a][b + b_size] == key)
+                            ++b_size;
+                        for (; a + a_size < size; ++a_size) {
+                            int i = 0;
+                            while (i < b_size && mask[a + a_size][b + i] == key)
+                                ++i;
+                            if (i < b_size)
+                                break;
+                        }
+                    }
+                    for (int i = 0; i < a_size; ++i) {
+                        for (int j = 0; j < b_size; ++j)
+                            mask[a + i][b + j] = 0;
+                    }
+
+                    Quad quad;
+                    quad.face = face;
+                    quad.block_id = static_cast<GLint>(key & 0xFFFFFFFF);
+                    quad.lo[axis] = quad.hi[axis] = scale * (slice + (face & 1));
+                    quad.lo[a_axis] = scale * a;
+                    quad.hi[a_axis] = scale * (a + a_size);
+                    quad.lo[b_axis] = scale * b;
+                    quad.hi[b_axis] = scale * (b + b_size);
+                    quads[static_cast<GLuint>(key >> 32)].push_back(quad);
+                }
+            }
+        }
+    }
+
+    ChunkMesh mesh;
+    for (const auto &[texture_array, group]: quads) {
+        ChunkMesh::Section section;
+        section.texture_array = texture_array;
+        section.first_index = static_cast<GLsizei>(mesh.indices.size());
+        for (const auto &quad: group)
+            EmitQuad(quad, mesh);
+        section.index_count = static_cast<GLsizei>(mesh.indices.size()) - section.first_index;
+        mesh.sections.push_back(section);
+    }
+    return mesh;
+}
+
+ChunkInstances ChunkMesher::build_instances() const
+{
+    std::map<GLuint, std::vector<ChunkInstances::Instance>> groups;
+    for (int x = 0; x < SIZE; ++x) {
+        for (int y = 0; y < SIZE; ++y) {
+            for (int z = 0; z < SIZE; ++z) {
+                const auto block_id = _at(x, y, z);
+                if (block_id == 0)
+                    continue;
+                GLint face_mask = 0;
+                for (int face = 0; face < 6; ++face) {
+                    const auto &dir = FACE_DIRECTION[face];
+                    if (_at(x + dir[0], y + dir[1], z + dir[2]) == 0)
+                        face_mask |= 1 << face;
+                }
+                if (!face_mask)
+                    continue;
+
+                const auto &model = _assets.block_by_id(block_id);
+                ChunkInstances::Instance instance;
+                instance.position = glm::vec3(x, y, z);
+                instance.block_id = static_cast<GLint>(block_id);
+                instance.face_mask = face_mask;
+                groups[static_cast<GLuint>(model.used_texture_array_id())].push_back(instance);
+            }
+        }
+    }
+
+    ChunkInstances instances;
+    for (const auto &[texture_array, group]: groups) {
+        ChunkInstances::Section section;
+        section.texture_array = texture_array;
+        section.first_instance = static_cast<GLint>(instances.instances.size());
+        section.instance_count = static_cast<GLsizei>(group.size());
+        instances.instances.insert(instances.instances.end(), group.begin(), group.end());
+        instances.sections.push_back(section);
+    }
+    return instances;
+}
+
+ChunkMesh ChunkMesher::UnitCube()
+{
+    ChunkMesh cube;
+    for (int face = 0; face < 6; ++face) {
+        Quad quad;
+        quad.face = face;
+        quad.block_id = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            quad.lo[axis] = 0;
+            quad.hi[axis] = 1;
+        }
+        quad.lo[FACE_AXIS[face]] = quad.hi[FACE_AXIS[face]] = face & 1;
+        EmitQuad(quad, cube);
+    }
+    cube.sections.push_back({0, 0, static_cast<GLsizei>(cube.indices.size())});
+    return cube;
+}
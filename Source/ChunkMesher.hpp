@@ -0,0 +1,147 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include "VoxelGrid.hpp"
+
+class AssetsRegister;
+
+
+struct ChunkMesh
+{
+    // Two words unpacked in the vertex shader: chunk-local position (POSITION_BITS per axis), face and texture
+    // coordinates in the first, block id and the slot of the chunk origin in the second
+    struct Vertex
+    {
+        static constexpr int POSITION_BITS = 5;
+        static constexpr int FACE_SHIFT = 3 * POSITION_BITS;
+        static constexpr int TEX_COORD_SHIFT = FACE_SHIFT + 3;
+        static constexpr GLuint POSITION_MASK = (1u << POSITION_BITS) - 1;
+        static_assert(VoxelGrid::Chunk::SIZE <= POSITION_MASK, "chunk corners must fit into the packed position");
+        static_assert(TEX_COORD_SHIFT + 2 * POSITION_BITS <= 32);
+
+        GLuint packed;
+        GLushort block_id;
+        // Set by the renderer when the mesh is uploaded
+        GLushort chunk_slot;
+
+        static Vertex Pack(glm::ivec3 position, int face, glm::ivec2 tex_coord, GLushort block_id) noexcept
+        {
+            return {static_cast<GLuint>(position.x | position.y << POSITION_BITS | position.z << 2 * POSITION_BITS |
+                                        face << FACE_SHIFT | tex_coord.x << TEX_COORD_SHIFT |
+                                        tex_coord.y << (TEX_COORD_SHIFT + POSITION_BITS)), block_id, 0};
+        }
+
+        glm::ivec3 position() const noexcept
+        {
+            return glm::ivec3(packed & POSITION_MASK, packed >> POSITION_BITS & POSITION_MASK,
+                              packed >> 2 * POSITION_BITS & POSITION_MASK);
+        }
+
+        int face() const noexcept
+        { return static_cast<int>(packed >> FACE_SHIFT & 7); }
+
+        glm::ivec2 tex_coord() const noexcept
+        {
+            return glm::ivec2(packed >> TEX_COORD_SHIFT & POSITION_MASK,
+                              packed >> (TEX_COORD_SHIFT + POSITION_BITS) & POSITION_MASK);
+        }
+    };
+
+    // Range of indices drawn with a single texture array bound
+    struct Section
+    {
+        GLuint texture_array;
+        GLsizei first_index;
+        GLsizei index_count;
+    };
+
+    std::vector<Vertex> vertices;
+    std::vector<GLuint> indices;
+    std::vector<Section> sections;
+
+    bool empty() const noexcept
+    { return indices.empty(); }
+};
+
+
+// Voxels with at least one exposed face, drawn as instances of a unit cube. Faces not in face_mask are hidden by
+// neighbours and get discarded in the vertex shader.
+struct ChunkInstances
+{
+    struct Instance
+    {
+        glm::vec3 position;
+        GLint block_id;
+        GLint face_mask;
+    };
+
+    // Range of instances drawn with a single texture array bound
+    struct Section
+    {
+        GLuint texture_array;
+        GLint first_instance;
+        GLsizei instance_count;
+    };
+
+    std::vector<Instance> instances;
+    std::vector<Section> sections;
+
+    bool empty() const noexcept
+    { return instances.empty(); }
+};
+
+
+// Builds a mesh with only the exposed faces of one chunk. The chunk is copied with a one voxel border of its
+// neighbours into a padded volume first, so face culling needs no bounds checks. With greedy meshing coplanar faces
+// of the same block are merged, and texture coordinates are in voxels (the atlas array must use GL_REPEAT). Vertices
+// carry block ids, the shader looks texture layers up in the material table of AssetsRegister.
+class ChunkMesher
+{
+public:
+    static constexpr int SIZE = VoxelGrid::Chunk::SIZE;
+    static constexpr int PADDED_SIZE = SIZE + 2;
+    // Coarsest level of detail, meshing cells of 2^MAX_LOD voxels
+    static constexpr int MAX_LOD = 3;
+    static_assert(SIZE >> MAX_LOD > 0);
+
+    // Levels of detail of the six neighbours by face, negative where a neighbour has no mesh
+    using NeighbourLods = std::array<int, 6>;
+    static constexpr NeighbourLods NO_NEIGHBOUR_LODS = {-1, -1, -1, -1, -1, -1};
+
+private:
+    const AssetsRegister &_assets;
+    bool _greedy;
+    std::vector<unsigned> _volume;
+
+    unsigned _at(int x, int y, int z) const
+    { return _volume[((x + 1) * PADDED_SIZE + (y + 1)) * PADDED_SIZE + (z + 1)]; }
+
+    // Cell (a, b) of 2^lod x 2^lod voxels of the neighbour layer beyond face, a and b along the axes following the
+    // face axis; takes the most common block id among them
+    unsigned _border_cell(int face, int lod, int a, int b) const;
+    // Padded volume of cells of 2^lod voxels, each taking the most common block id among its voxels. The border only
+    // has the single layer of neighbour voxels to vote on.
+    std::vector<unsigned> _downsample(int lod) const;
+
+public:
+    explicit ChunkMesher(const AssetsRegister &assets, bool greedy = true);
+
+    bool greedy() const noexcept
+    { return _greedy; }
+
+    void set_greedy(bool greedy) noexcept
+    { _greedy = greedy; }
+
+    void gather(const VoxelGrid &grid, glm::ivec3 chunk_pos);
+    // Level of detail lod merges cubes of 2^lod voxels into single cells before meshing. Along a neighbour meshed at
+    // another level, faces are kept wherever any of its cells in front of them is air, closing the cracks between the
+    // levels.
+    ChunkMesh build(int lod = 0, const NeighbourLods &neighbour_lods = NO_NEIGHBOUR_LODS) const;
+    ChunkInstances build_instances() const;
+
+    // The six faces of one voxel at the origin, in the vertex format of chunk meshes, to be drawn instanced
+    static ChunkMesh UnitCube();
+};
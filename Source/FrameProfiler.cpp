@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <fmt/format.h>
+#include "FrameProfiler.hpp"
+#include "GL/Misc.hpp"
+
+
+FrameProfiler::FrameProfiler()
+{
+    _frame_starts.fill(Clock::now());
+    _frame_ms.fill(-1);
+}
+
+FrameProfiler::~FrameProfiler()
+{
+    release();
+}
+
+unsigned FrameProfiler::add_pass(std::string name, bool gpu)
+{
+    auto &pass = _passes.emplace_back();
+    pass.name = std::move(name);
+    pass.gpu = gpu;
+    pass.query_frames.fill(NO_FRAME);
+    if (gpu) {
+        glGenQueries(QUERY_LATENCY, pass.queries.data());
+        GL::GLError::RaiseIfError();
+    }
+    return static_cast<unsigned>(_passes.size() - 1);
+}
+
+void FrameProfiler::begin_frame()
+{
+    const auto now = Clock::now();
+    if (_frame > 0) {
+        const auto previous = _frame % HISTORY;
+        _frame_ms[previous] = std::chrono::duration<float, std::milli>(now - _frame_starts[previous]).count();
+    }
+    ++_frame;
+    _collect_queries();
+    const auto slot = _frame % HISTORY;
+    _frame_starts[slot] = now;
+    _frame_ms[slot] = -1;
+    for (auto &pass: _passes)
+        pass.samples[slot] = Sample();
+}
+
+void FrameProfiler::_collect_queries()
+{
+    const auto query_slot = _frame % QUERY_LATENCY;
+    for (auto &pass: _passes) {
+        auto &frame = pass.query_frames[query_slot];
+        if (frame == NO_FRAME)
+            continue;
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(pass.queries[query_slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 nanoseconds;
+            glGetQueryObjectui64v(pass.queries[query_slot], GL_QUERY_RESULT, &nanoseconds);
+            pass.samples[frame % HISTORY].gpu_ms = static_cast<float>(nanoseconds * 1e-6);
+        }
+        frame = NO_FRAME;
+    }
+}
+
+void FrameProfiler::_begin(unsigned pass_index)
+{
+    if (!_enabled)
+        return;
+    auto &pass = _passes[pass_index];
+    auto &sample = pass.samples[_frame % HISTORY];
+    // A pass running more than once in a frame is traced as one event from its first start
+    pass.begin = Clock::now();
+    if (sample.cpu_ms < 0)
+        sample.start = pass.begin;
+    const auto query_slot = _frame % QUERY_LATENCY;
+    // A pass running twice in a frame is measured only the first time on the GPU
+    if (pass.gpu && pass.query_frames[query_slot] == NO_FRAME) {
+        glBeginQuery(GL_TIME_ELAPSED, pass.queries[query_slot]);
+        pass.query_frames[query_slot] = _frame;
+    }
+}
+
+void FrameProfiler::_end(unsigned pass_index)
+{
+    if (!_enabled)
+        return;
+    auto &pass = _passes[pass_index];
+    const auto query_slot = _frame % QUERY_LATENCY;
+    if (pass.gpu && pass.query_frames[query_slot] == _frame)
+        glEndQuery(GL_TIME_ELAPSED);
+    auto &sample = pass.samples[_frame % HISTORY];
+    const auto elapsed = std::chrono::duration<float, std::milli>(Clock::now() - pass.begin).count();
+    sample.cpu_ms = std::max(sample.cpu_ms, 0.0f) + elapsed;
+}
+
+FrameProfiler::Statistics FrameProfiler::_statistics(std::vector<float> &values)
+{
+    Statistics statistics;
+    if (values.empty())
+        return statistics;
+    std::sort(values.begin(), values.end());
+    statistics.samples = static_cast<unsigned>(values.size());
+    statistics.min = values.front();
+    double sum = 0;
+    for (auto value: values)
+        sum += value;
+    statistics.average = sum / values.size();
+    const auto p99_rank = static_cast<std::size_t>(std::ceil(0.99 * values.size()));
+    statistics.p99 = values[std::max<std::size_t>(p99_rank, 1) - 1];
+    return statistics;
+}
+
+FrameProfiler::Statistics FrameProfiler::frame_statistics() const
+{
+    std::vector<float> values;
+    for (auto ms: _frame_ms)
+        if (ms >= 0)
+            values.push_back(ms);
+    return _statistics(values);
+}
+
+FrameProfiler::Statistics FrameProfiler::cpu_statistics(unsigned pass) const
+{
+    std::vector<float> values;
+    for (const auto &sample: _passes[pass].samples)
+        if (sample.cpu_ms >= 0)
+            values.push_back(sample.cpu_ms);
+    return _statistics(values);
+}
+
+FrameProfiler::Statistics FrameProfiler::gpu_statistics(unsigned pass) const
+{
+    std::vector<float> values;
+    for (const auto &sample: _passes[pass].samples)
+        if (sample.gpu_ms >= 0)
+            values.push_back(sample.gpu_ms);
+    return _statistics(values);
+}
+
+void FrameProfiler::print_statistics(std::ostream &out) const
+{
+    const auto print = [&out](std::string_view name, std::string_view unit, const Statistics &statistics) {
+        if (!statistics.samples)
+            return;
+        out << fmt::format("{:<12} {}  min {:7.3f}  avg {:7.3f}  p99 {:7.3f} ms  ({} frames)\n", name, unit,
+                           statistics.min, statistics.average, statistics.p99, statistics.samples);
+    };
+    print("frame", "CPU", frame_statistics());
+    for (unsigned i = 0; i < _passes.size(); ++i) {
+        print(_passes[i].name, "CPU", cpu_statistics(i));
+        print(_passes[i].name, "GPU", gpu_statistics(i));
+    }
+}
+
+void FrameProfiler::write_trace(const std::filesystem::path &path) const
+{
+    std::ofstream out(path);
+    if (!out.is_open())
+        throw GL::Error("unable to open trace file '{}'", path.string());
+
+    // Timestamps relative to the oldest frame in the history, in microseconds
+    const auto frames = std::min<std::uint64_t>(_frame, HISTORY);
+    const auto origin = _frame_starts[(_frame - frames + 1) % HISTORY];
+    const auto microseconds = [origin](Clock::time_point time) {
+        return std::chrono::duration<double, std::micro>(time - origin).count();
+    };
+    const auto event = [&out](std::string_view name, int thread, double start, double duration) {
+        out << fmt::format(R"(,
+  {{"name": "{}", "ph": "X", "pid": 1, "tid": {}, "ts": {:.3f}, "dur": {:.3f}}})",
+                           name, thread, start, duration);
+    };
+
+    out << R"({"displayTimeUnit": "ms", "traceEvents": [)" "\n";
+    for (auto [thread, name]: {std::pair{0, "Frames"}, {1, "CPU"}, {2, "GPU"}}) {
+        out << fmt::format(R"(  {{"name": "thread_name", "ph": "M", "pid": 1, "tid": {}, "args": {{"name": "{}"}}}})",
+                           thread, name);
+        if (thread != 2)
+            out << ",\n";
+    }
+    for (auto frame = _frame - frames + 1; frame <= _frame; ++frame) {
+        const auto slot = frame % HISTORY;
+        if (_frame_ms[slot] >= 0)
+            event("frame", 0, microseconds(_frame_starts[slot]), _frame_ms[slot] * 1000.0);
+        for (const auto &pass: _passes) {
+            const auto &sample = pass.samples[slot];
+            if (sample.cpu_ms >= 0)
+                event(pass.name, 1, microseconds(sample.start), sample.cpu_ms * 1000.0);
+            if (sample.gpu_ms >= 0)
+                event(pass.name, 2, microseconds(sample.start), sample.gpu_ms * 1000.0);
+        }
+    }
+    out << "\n]}\n";
+    if (!out)
+        throw GL::Error("unable to write trace file '{}'", path.string());
+}
+
+void FrameProfiler::release() noexcept
+{
+    for (auto &pass: _passes) {
+        if (pass.gpu && pass.queries[0]) {
+            glDeleteQueries(QUERY_LATENCY, pass.queries.data());
+            pass.queries.fill(0);
+        }
+        pass.query_frames.fill(NO_FRAME);
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+
+// CPU and GPU times of named passes over the last HISTORY frames. GPU times are measured with GL_TIME_ELAPSED queries,
+// which cannot nest, so passes measured on the GPU must not overlap. Every pass has a query for each of the last
+// QUERY_LATENCY frames and reads the oldest one only when its result is available, so reading never stalls; a result
+// still missing by then is dropped.
+class FrameProfiler
+{
+public:
+    static constexpr unsigned HISTORY = 300;
+    static constexpr unsigned QUERY_LATENCY = 2;
+
+    using Clock = std::chrono::steady_clock;
+
+    // Milliseconds over the frames in the history the pass ran in
+    struct Statistics
+    {
+        unsigned samples = 0;
+        double min = 0, average = 0, p99 = 0;
+    };
+
+    // Measures a pass from construction to destruction
+    class Scope
+    {
+        FrameProfiler &_profiler;
+        unsigned _pass;
+
+    public:
+        Scope(FrameProfiler &profiler, unsigned pass) :
+            _profiler(profiler),
+            _pass(pass)
+        { _profiler._begin(_pass); }
+
+        Scope(const Scope &other) = delete;
+
+        ~Scope()
+        { _profiler._end(_pass); }
+    };
+
+private:
+    // Negative times mark passes that did not run in the frame or GPU results that were not read
+    struct Sample
+    {
+        Clock::time_point start;
+        float cpu_ms = -1;
+        float gpu_ms = -1;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        bool gpu;
+        // Start of the current run of the pass
+        Clock::time_point begin;
+        std::array<GLuint, QUERY_LATENCY> queries{};
+        // Frame the query of each slot measured, NO_FRAME if it was not issued
+        std::array<std::uint64_t, QUERY_LATENCY> query_frames;
+        std::array<Sample, HISTORY> samples;
+    };
+
+    static constexpr std::uint64_t NO_FRAME = ~std::uint64_t(0);
+
+    std::vector<Pass> _passes;
+    std::array<Clock::time_point, HISTORY> _frame_starts;
+    std::array<float, HISTORY> _frame_ms;
+    std::uint64_t _frame = 0;
+    bool _enabled = true;
+
+    void _begin(unsigned pass);
+    void _end(unsigned pass);
+    void _collect_queries();
+    static Statistics _statistics(std::vector<float> &values);
+
+public:
+    FrameProfiler();
+    FrameProfiler(const FrameProfiler &other) = delete;
+    ~FrameProfiler();
+
+    // Disabled profiler makes scopes do nothing, the collected history is kept
+    void set_enabled(bool enabled) noexcept
+    { _enabled = enabled; }
+
+    bool enabled() const noexcept
+    { return _enabled; }
+
+    // Passes measured only on the CPU may overlap others
+    unsigned add_pass(std::string name, bool gpu);
+
+    void begin_frame();
+
+    // Whole frames, from one begin_frame() to the next
+    Statistics frame_statistics() const;
+    Statistics cpu_statistics(unsigned pass) const;
+    Statistics gpu_statistics(unsigned pass) const;
+    void print_statistics(std::ostream &out) const;
+
+    // Chrome trace event JSON of the history, loadable by chrome://tracing or Perfetto. GPU passes are placed at the
+    // CPU time they were issued at, elapsed time queries do not tell when the GPU actually ran them.
+    void write_trace(const std::filesystem::path &path) const;
+
+    void release() noexcept;
+};
@@ -0,0 +1,71 @@
+#include <algorithm>
+#include "Frustum.hpp"
+
+
+void AabbList::clear() noexcept
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        _lo[axis].clear();
+        _hi[axis].clear();
+    }
+    _size = 0;
+}
+
+void AabbList::push_back(glm::vec3 lo, glm::vec3 hi)
+{
+    // Storage grows by whole groups, so tests always read LANES boxes at once
+    if (_size % Frustum::LANES == 0) {
+        for (int axis = 0; axis < 3; ++axis) {
+            _lo[axis].resize(_size + Frustum::LANES, 0.0f);
+            _hi[axis].resize(_size + Frustum::LANES, 0.0f);
+        }
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        _lo[axis][_size] = lo[axis];
+        _hi[axis][_size] = hi[axis];
+    }
+    ++_size;
+}
+
+
+Frustum::Frustum(const glm::mat4 &view_projection)
+{
+    // Gribb-Hartmann: the planes are sums and differences of the last row with the other rows of the matrix
+    const auto row = [&](int i) {
+        return glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+    };
+    for (int axis = 0; axis < 3; ++axis) {
+        _planes[2 * axis] = row(3) + row(axis);
+        _planes[2 * axis + 1] = row(3) - row(axis);
+    }
+}
+
+bool Frustum::intersects(glm::vec3 lo, glm::vec3 hi) const
+{
+    for (const auto &plane: _planes) {
+        // Corner of the box furthest along the plane normal
+        const glm::vec3 corner(plane.x > 0 ? hi.x : lo.x, plane.y > 0 ? hi.y : lo.y, plane.z > 0 ? hi.z : lo.z);
+        if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0)
+            return false;
+    }
+    return true;
+}
+
+void Frustum::test(const AabbList &boxes, std::vector<std::uint8_t> &visible) const
+{
+    visible.resize(boxes._lo[0].size());
+    for (std::size_t first = 0; first < boxes._size; first += LANES) {
+        std::uint8_t inside[LANES];
+        std::fill(std::begin(inside), std::end(inside), 1);
+        for (const auto &plane: _planes) {
+            // The corner furthest along the normal is chosen once per plane, not per box
+            const float *x = (plane.x > 0 ? boxes._hi[0] : boxes._lo[0]).data() + first;
+            const float *y = (plane.y > 0 ? boxes._hi[1] : boxes._lo[1]).data() + first;
+            const float *z = (plane.z > 0 ? boxes._hi[2] : boxes._lo[2]).data() + first;
+            for (std::size_t i = 0; i < LANES; ++i)
+                inside[i] &= plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w >= 0;
+        }
+        std::copy(std::begin(inside), std::end(inside), visible.begin() + first);
+    }
+    visible.resize(boxes._size);
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+
+// Axis-aligned boxes in structure-of-arrays layout, padded to whole groups of Frustum::LANES boxes
+class AabbList
+{
+    std::vector<float> _lo[3], _hi[3];
+    std::size_t _size = 0;
+
+    friend class Frustum;
+
+public:
+    std::size_t size() const noexcept
+    { return _size; }
+
+    void clear() noexcept;
+    void push_back(glm::vec3 lo, glm::vec3 hi);
+};
+
+
+// View frustum as six planes extracted from a projection * view matrix; plane normals point inside
+class Frustum
+{
+public:
+    // Boxes tested together; the loop over them is branch-free, so the compiler turns it into SIMD instructions
+    static constexpr std::size_t LANES = 8;
+
+private:
+    glm::vec4 _planes[6];
+
+public:
+    explicit Frustum(const glm::mat4 &view_projection);
+
+    bool intersects(glm::vec3 lo, glm::vec3 hi) const;
+    // Sets visible[i] to 1 if box i may be visible and to 0 if it is certainly outside of the frustum
+    void test(const AabbList &boxes, std::vector<std::uint8_t> &visible) const;
+};
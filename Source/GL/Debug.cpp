@@ -0,0 +1,129 @@
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include "Debug.hpp"
+
+namespace GL {
+
+namespace {
+
+enum class Api { NONE, KHR, ARB };
+
+Api DebugApi = Api::NONE;
+std::optional<GLError> PendingError;
+unsigned PendingErrorCount = 0;
+thread_local const char *CurrentScope = nullptr;
+
+const char *SourceName(GLenum source)
+{
+    switch (source) {
+        case GL_DEBUG_SOURCE_API: return "API";
+        case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "window system";
+        case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+        case GL_DEBUG_SOURCE_THIRD_PARTY: return "third party";
+        case GL_DEBUG_SOURCE_APPLICATION: return "application";
+    }
+    return "other";
+}
+
+const char *SeverityName(GLenum severity)
+{
+    switch (severity) {
+        case GL_DEBUG_SEVERITY_HIGH: return "high";
+        case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+        case GL_DEBUG_SEVERITY_LOW: return "low";
+    }
+    return "notification";
+}
+
+void GLAPIENTRY Callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length,
+                         const GLchar *message, const void *)
+{
+    if (type == GL_DEBUG_TYPE_PUSH_GROUP || type == GL_DEBUG_TYPE_POP_GROUP)
+        return;
+    const std::string_view text(message, length < 0 ? std::strlen(message) : length);
+    const std::string_view scope = CurrentScope ? CurrentScope : "no scope";
+    // Exceptions must not unwind through the driver
+    if (type == GL_DEBUG_TYPE_ERROR) {
+        if (!PendingErrorCount++)
+            PendingError.emplace("OpenGL error #{} in {}: {}", id, scope, text);
+        return;
+    }
+    std::cerr << fmt::format("GL {} ({}, {} severity) in {}: {}", SourceName(source), id, SeverityName(severity),
+                             scope, text) << std::endl;
+}
+
+void MessageControl(GLenum source, GLenum severity, bool enabled)
+{
+    if (DebugApi == Api::KHR)
+        glDebugMessageControl(source, GL_DONT_CARE, severity, 0, nullptr, enabled);
+    else
+        glDebugMessageControlARB(source, GL_DONT_CARE, severity, 0, nullptr, enabled);
+}
+
+}
+
+bool DebugOutput::Enable(GLenum min_severity)
+{
+    if (GLEW_KHR_debug) {
+        DebugApi = Api::KHR;
+        glEnable(GL_DEBUG_OUTPUT);
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+        glDebugMessageCallback(Callback, nullptr);
+    } else if (GLEW_ARB_debug_output) {
+        DebugApi = Api::ARB;
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_ARB);
+        glDebugMessageCallbackARB(Callback, nullptr);
+    } else {
+        return false;
+    }
+    // From the least severe, disabled up to min_severity
+    for (GLenum severity: {GL_DEBUG_SEVERITY_NOTIFICATION, GL_DEBUG_SEVERITY_LOW, GL_DEBUG_SEVERITY_MEDIUM}) {
+        if (severity == min_severity)
+            break;
+        // ARB_debug_output has no notifications
+        if (DebugApi == Api::KHR || severity != GL_DEBUG_SEVERITY_NOTIFICATION)
+            MessageControl(GL_DONT_CARE, severity, false);
+    }
+    return true;
+}
+
+bool DebugOutput::Enabled() noexcept
+{
+    return DebugApi != Api::NONE;
+}
+
+void DebugOutput::IgnoreSource(GLenum source)
+{
+    if (Enabled())
+        MessageControl(source, GL_DONT_CARE, false);
+}
+
+void DebugOutput::RaisePending()
+{
+    if (!PendingErrorCount)
+        return;
+    auto error = std::move(*PendingError);
+    if (PendingErrorCount > 1)
+        error = GLError("{} (and {} more errors)", error.message(), PendingErrorCount - 1);
+    PendingError.reset();
+    PendingErrorCount = 0;
+    throw error;
+}
+
+DebugScope::DebugScope(const char *name) :
+    _outer(CurrentScope)
+{
+    CurrentScope = name;
+    if (DebugApi == Api::KHR)
+        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+}
+
+DebugScope::~DebugScope()
+{
+    if (DebugApi == Api::KHR)
+        glPopDebugGroup();
+    CurrentScope = _outer;
+}
+
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "Misc.hpp"
+
+namespace GL {
+
+// Error reporting through KHR_debug or ARB_debug_output instead of polling glGetError. Output is synchronous, so the
+// driver calls back from within the offending command on the thread that issued it. Errors are kept until
+// RaisePending() and other messages are printed to stderr, both prefixed with the innermost DebugScope of that thread.
+class DebugOutput
+{
+public:
+    // Installs the callback if the context supports debug output, messages less severe than min_severity are dropped
+    // by the driver
+    static bool Enable(GLenum min_severity = GL_DEBUG_SEVERITY_LOW);
+    static bool Enabled() noexcept;
+    // Drops all messages coming from source (one of GL_DEBUG_SOURCE_*)
+    static void IgnoreSource(GLenum source);
+    // Throws the first error reported since the previous call and forgets the others
+    static void RaisePending();
+};
+
+// Names the commands issued during its lifetime in debug messages, and in frame debuggers when KHR_debug is present
+class DebugScope
+{
+    const char *_outer;
+
+public:
+    explicit DebugScope(const char *name);
+    DebugScope(const DebugScope &other) = delete;
+    ~DebugScope();
+};
+
+}
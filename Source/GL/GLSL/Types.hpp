@@ -1 +1,19 @@
 #pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+namespace GL::GLSL {
+
+// Contents of the std140 Camera uniform block of the world shaders
+struct Camera
+{
+    static constexpr const char *BLOCK_NAME = "Camera";
+    static constexpr GLuint BINDING = 0;
+
+    glm::mat4 view_matrix;
+    glm::mat4 projection_matrix;
+};
+
+static_assert(sizeof(Camera) == 2 * 16 * sizeof(float), "std140 lays a mat4 out as four vec4 columns");
+
+}
@@ -2,22 +2,28 @@
 #include <fstream>
 #include <png++/png.hpp>
 #include "Misc.hpp"
+#include "State.hpp"
 
 namespace GL {
 
-void GLError::RaiseIfError()
+#if !defined(NDEBUG) || defined(YAOGLS_GL_ERROR_POLLING)
+void GLError::RaiseIfError(std::source_location where)
 {
     auto code = glGetError();
     if (code != GL_NO_ERROR) {
         unsigned count = 0;
         while (glGetError() != GL_NO_ERROR)
             ++count;
+        const auto error = fmt::format("OpenGL error #{}: {} at {}:{}", code,
+                                       reinterpret_cast<const char *>(gluErrorString(code)),
+                                       where.file_name(), where.line());
         if (count)
-            throw GLError("OpenGL error #{}: {} (and {} more errors)", code, gluErrorString(code), code);
+            throw GLError("{} (and {} more errors)", error, count);
         else
-            throw GLError("OpenGL error #{}: {}", code, gluErrorString(code));
+            throw GLError(error);
     }
 }
+#endif
 
 std::string ReadFile(const std::filesystem::path &path)
 {
@@ -38,7 +44,7 @@ GLuint LoadTextureImage(const std::filesystem::path &path)
     GLError::RaiseIfError();
 
     auto [width, height, data] = LoadImageData(path);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    State::Current().bind_texture(0, GL_TEXTURE_2D, texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, static_cast<GLint>(width), static_cast<GLint>(height), 0,
                  GL_RGBA, GL_UNSIGNED_BYTE, data.data());
 
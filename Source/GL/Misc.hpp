@@ -5,6 +5,7 @@
 #include <fmt/format.h>
 #include <exception>
 #include <filesystem>
+#include <source_location>
 #include <string_view>
 #include <vector>
 
@@ -41,7 +42,13 @@ public:
 class GLError : public Error
 {
 public:
-    static void RaiseIfError();
+#if !defined(NDEBUG) || defined(YAOGLS_GL_ERROR_POLLING)
+    static void RaiseIfError(std::source_location where = std::source_location::current());
+#else
+    // Polling glGetError serialises the driver, release builds rely on DebugOutput instead
+    static void RaiseIfError() noexcept
+    {}
+#endif
     using Error::Error;
 
     const char *what() const noexcept override
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include "ProgramCache.hpp"
+
+namespace GL {
+
+namespace {
+
+constexpr char MAGIC[8] = {'Y', 'G', 'L', 'P', 'R', 'O', 'G', '1'};
+
+struct Header
+{
+    char magic[sizeof(MAGIC)];
+    std::uint64_t key;
+    GLenum format;
+    std::uint32_t length;
+};
+
+// 64-bit FNV-1a over the length and the bytes of data, so that the boundaries between chained strings count as well
+std::uint64_t Hash(std::uint64_t hash, std::string_view data) noexcept
+{
+    const auto mix = [&hash](unsigned char byte) {
+        hash ^= byte;
+        hash *= 1099511628211ull;
+    };
+    for (std::size_t size = data.size(), i = 0; i < sizeof(size); ++i)
+        mix(static_cast<unsigned char>(size >> (8 * i)));
+    for (char c: data)
+        mix(static_cast<unsigned char>(c));
+    return hash;
+}
+
+}
+
+ProgramCache::ProgramCache(std::filesystem::path directory) :
+    _directory(std::move(directory))
+{
+    GLint formats_count = 0;
+    if (GLEW_ARB_get_program_binary)
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats_count);
+    if (_directory.empty() || formats_count <= 0)
+        return;
+    _formats.resize(formats_count);
+    glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, _formats.data());
+    GLError::RaiseIfError();
+
+    _driver_hash = 14695981039346656037ull;
+    for (auto name: {GL_VENDOR, GL_RENDERER, GL_VERSION})
+        _driver_hash = Hash(_driver_hash, reinterpret_cast<const char *>(glGetString(name)));
+    const std::string_view formats(reinterpret_cast<const char *>(_formats.data()), _formats.size() * sizeof(GLint));
+    _driver_hash = Hash(_driver_hash, formats);
+
+    std::error_code error;
+    std::filesystem::create_directories(_directory, error);
+    _enabled = !error;
+}
+
+std::filesystem::path ProgramCache::_path(std::uint64_t key) const
+{
+    return _directory / fmt::format("{:016x}.bin", key);
+}
+
+std::uint64_t ProgramCache::key(std::initializer_list<std::string_view> sources) const noexcept
+{
+    auto key = _driver_hash;
+    for (auto source: sources)
+        key = Hash(key, source);
+    return key;
+}
+
+bool ProgramCache::load(std::uint64_t key, ShaderProgram &program) const
+{
+    if (!_enabled)
+        return false;
+    std::ifstream file(_path(key), std::ios::binary);
+    Header header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)))
+        return false;
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.key != key
+            || std::find(_formats.begin(), _formats.end(), GLint(header.format)) == _formats.end())
+        return false;
+    std::vector<char> data(header.length);
+    if (!file.read(data.data(), data.size()))
+        return false;
+    if (program.link_binary(header.format, data.data(), static_cast<GLsizei>(data.size())))
+        return true;
+    program = ShaderProgram();
+    return false;
+}
+
+void ProgramCache::store(std::uint64_t key, const ShaderProgram &program) const
+{
+    if (!_enabled)
+        return;
+    GLenum format;
+    const auto data = program.binary(format);
+    if (data.empty())
+        return;
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.key = key;
+    header.format = format;
+    header.length = static_cast<std::uint32_t>(data.size());
+    // Written aside and renamed, so that an interrupted write never leaves a truncated binary under the key
+    const auto path = _path(key);
+    auto temporary_path = path;
+    temporary_path += ".tmp";
+    {
+        std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+        if (!file)
+            return;
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary_path, path, error);
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <initializer_list>
+#include <string_view>
+#include "Shaders.hpp"
+
+namespace GL {
+
+// Directory of linked program binaries, one file per program. Keys cover the sources of the program, the driver
+// identification strings and the binary formats it accepts. Binaries the driver rejects anyway are rebuilt by the
+// caller and stored again.
+class ProgramCache
+{
+    std::filesystem::path _directory;
+    std::vector<GLint> _formats;
+    std::uint64_t _driver_hash = 0;
+    bool _enabled = false;
+
+    std::filesystem::path _path(std::uint64_t key) const;
+
+public:
+    // Needs a current context; the cache stays disabled if directory is empty, cannot be created, or the driver has no
+    // binary formats
+    explicit ProgramCache(std::filesystem::path directory);
+
+    bool enabled() const noexcept
+    { return _enabled; }
+
+    // Sources are expected in the order of the pipeline stages
+    std::uint64_t key(std::initializer_list<std::string_view> sources) const noexcept;
+    // Links program from the stored binary; on failure program is reset and false is returned
+    bool load(std::uint64_t key, ShaderProgram &program) const;
+    // Failing to write is not an error, the program is only built from sources again next time
+    void store(std::uint64_t key, const ShaderProgram &program) const;
+};
+
+}
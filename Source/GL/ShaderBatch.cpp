@@ -0,0 +1,47 @@
+#include <algorithm>
+#include "ShaderBatch.hpp"
+
+namespace GL {
+
+void ShaderBatch::add(ShaderProgram &program, std::vector<Shader> shaders,
+                      std::function<void(ShaderProgram &)> on_linked)
+{
+    static bool threads_requested = false;
+    if (!threads_requested && GLEW_KHR_parallel_shader_compile) {
+        // As many compiler threads as the driver finds reasonable
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+        threads_requested = true;
+    }
+    // A program linked from shaders that are still compiling waits for them inside the driver, not here
+    for (auto &shader: shaders) {
+        shader.submit();
+        program.attach(shader);
+    }
+    program.submit_link();
+    _entries.push_back({&program, std::move(shaders), std::move(on_linked)});
+}
+
+bool ShaderBatch::completed() const
+{
+    return std::all_of(_entries.begin(), _entries.end(), [](const Entry &entry) {
+        return entry.program->completed();
+    });
+}
+
+void ShaderBatch::finish()
+{
+    auto entries = std::move(_entries);
+    _entries.clear();
+    for (auto &entry: entries) {
+        // Compilation errors say more than the link error they cause
+        for (auto &shader: entry.shaders)
+            shader.finish();
+        entry.program->finish_link();
+        for (const auto &shader: entry.shaders)
+            entry.program->detach(shader);
+        if (entry.on_linked)
+            entry.on_linked(*entry.program);
+    }
+}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <functional>
+#include "Shaders.hpp"
+
+namespace GL {
+
+// Compiles and links a set of programs together. Everything is handed to the driver before any result is asked for,
+// since each status query waits for its compile or link to finish. With KHR_parallel_shader_compile the driver works
+// on them in its own threads while the application does something else, until finish() collects the results.
+class ShaderBatch
+{
+    struct Entry
+    {
+        ShaderProgram *program;
+        std::vector<Shader> shaders;
+        std::function<void(ShaderProgram &)> on_linked;
+    };
+
+    std::vector<Entry> _entries;
+
+public:
+    // Submits compilation of the shaders and the link of program from them; program must outlive finish(). on_linked
+    // is called from finish() once the program is linked.
+    void add(ShaderProgram &program, std::vector<Shader> shaders, std::function<void(ShaderProgram &)> on_linked = {});
+    // Tells whether finish() would not block
+    bool completed() const;
+    // Waits for all programs in the order they were added, the first failure is thrown as ShaderCompilationError
+    void finish();
+};
+
+}
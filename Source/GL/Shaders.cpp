@@ -9,6 +9,9 @@ Shader &Shader::operator=(Shader &&other)
 
     _delete();
     _id = other._id;
+    other._id = 0;
+    _type = other._type;
+    _pending = other._pending;
 
     _sources = std::move(other._sources);
     _log = std::move(other._log);
@@ -42,11 +45,13 @@ void Shader::add_source(std::shared_ptr<std::string> code_ptr)
     _sources.push_back(std::move(code_ptr));
 }
 
-void Shader::compile()
+// Queries about the compilation block until it is finished, so submit() does not ask anything
+void Shader::submit()
 {
-    if (_compiled)
+    if (_compiled || _pending)
         return;
-    create();
+    if (!_id)
+        create();
 
     std::vector<const char *> source_pointers;
     source_pointers.reserve(_sources.size());
@@ -55,6 +60,24 @@ void Shader::compile()
     glShaderSource(_id, source_pointers.size(), source_pointers.data(), nullptr);
 
     glCompileShader(_id);
+    _pending = true;
+}
+
+bool Shader::completed() const
+{
+    if (!_pending || !GLEW_KHR_parallel_shader_compile)
+        return true;
+    int result;
+    glGetShaderiv(_id, GL_COMPLETION_STATUS_KHR, &result);
+    return result == GL_TRUE;
+}
+
+void Shader::finish()
+{
+    if (_compiled)
+        return;
+    assert(_pending);
+    _pending = false;
 
     int log_len;
     glGetShaderiv(_id, GL_INFO_LOG_LENGTH, &log_len);
@@ -76,18 +99,25 @@ void Shader::compile()
 
 ShaderProgram &ShaderProgram::operator=(ShaderProgram &&other)
 {
-    if (_id)
+    if (_id) {
+        State::Current().forget_program(_id);
         glDeleteProgram(_id);
+    }
     _id = other._id;
     other._id = 0;
     _log = std::move(other._log);
+    _linked = other._linked;
+    _pending = other._pending;
+    _uniforms = std::move(other._uniforms);
     return *this;
 }
 
 ShaderProgram::~ShaderProgram()
 {
-    if (_id)
+    if (_id) {
+        State::Current().forget_program(_id);
         glDeleteProgram(_id);
+    }
 }
 
 void ShaderProgram::attach(const Shader &shader)
@@ -107,14 +137,37 @@ void ShaderProgram::detach(const Shader &shader)
     GLError::RaiseIfError();
 }
 
-void ShaderProgram::link()
+void ShaderProgram::submit_link()
 {
     if (!_id)
         throw GLError("no shaders were attached to this program");
-    if (_linked)
+    if (_linked || _pending)
         return;
 
+    // Without the hint some drivers have no binary to return for the program cache
+    if (GLEW_ARB_get_program_binary)
+        glProgramParameteri(_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(_id);
+    // Linking resets all uniforms to their defaults
+    _uniforms.clear();
+    _pending = true;
+}
+
+bool ShaderProgram::completed() const
+{
+    if (!_pending || !GLEW_KHR_parallel_shader_compile)
+        return true;
+    int result;
+    glGetProgramiv(_id, GL_COMPLETION_STATUS_KHR, &result);
+    return result == GL_TRUE;
+}
+
+void ShaderProgram::finish_link()
+{
+    if (_linked)
+        return;
+    assert(_pending);
+    _pending = false;
 
     int log_len;
     glGetProgramiv(_id, GL_INFO_LOG_LENGTH, &log_len);
@@ -129,6 +182,68 @@ void ShaderProgram::link()
     if (result != GL_TRUE)
         throw ShaderCompilationError(fmt::format("failed to link program"), _log);
     _linked = true;
+    _load_uniforms();
+    GLError::RaiseIfError();
+}
+
+bool ShaderProgram::link_binary(GLenum format, const void *data, GLsizei length)
+{
+    if (!_id)
+        _id = glCreateProgram();
+    glProgramBinary(_id, format, data, length);
+    _uniforms.clear();
+    _pending = false;
+
+    int result;
+    glGetProgramiv(_id, GL_LINK_STATUS, &result);
+    _linked = result == GL_TRUE;
+    if (_linked)
+        _load_uniforms();
+    GLError::RaiseIfError();
+    return _linked;
+}
+
+std::vector<std::byte> ShaderProgram::binary(GLenum &format) const
+{
+    GLint length = 0;
+    glGetProgramiv(_id, GL_PROGRAM_BINARY_LENGTH, &length);
+    std::vector<std::byte> data(length);
+    if (length > 0)
+        glGetProgramBinary(_id, length, &length, &format, data.data());
+    data.resize(length);
+    GLError::RaiseIfError();
+    return data;
+}
+
+void ShaderProgram::_load_uniforms()
+{
+    GLint count, max_length;
+    glGetProgramiv(_id, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    std::string name(max_length, '\0');
+    for (GLint i = 0; i < count; ++i) {
+        GLsizei length;
+        GLint size;
+        GLenum type;
+        glGetActiveUniform(_id, i, max_length, &length, &size, &type, name.data());
+        std::string_view name_view(name.data(), length);
+        // Arrays are reported by their first element and written as a whole
+        if (name_view.ends_with("[0]"))
+            name_view.remove_suffix(3);
+        // Members of uniform blocks have no location
+        const auto location = glGetUniformLocation(_id, name.c_str());
+        if (location < 0)
+            continue;
+        if (!_uniforms.try_emplace(UniformName::Hash(name_view), Uniform{location, {}}).second)
+            throw GLError("uniform '{}' collides with another uniform of the program", name_view);
+    }
+}
+
+void ShaderProgram::bind_uniform_block(const char *block_name, GLuint binding)
+{
+    const auto index = glGetUniformBlockIndex(_id, block_name);
+    if (index != GL_INVALID_INDEX)
+        glUniformBlockBinding(_id, index, binding);
     GLError::RaiseIfError();
 }
 
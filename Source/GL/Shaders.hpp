@@ -1,7 +1,13 @@
 #pragma once
 #include "Misc.hpp"
+#include "State.hpp"
+#include <array>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <string_view>
+#include <unordered_map>
 #include <glm/gtc/type_ptr.hpp>
 
 namespace GL {
@@ -14,6 +20,8 @@ protected:
     GLuint _id = 0;
     GLenum _type;
     bool _compiled;
+    // Compilation was started by submit() and its result not yet collected by finish()
+    bool _pending = false;
     bool _auto_free;
     std::string _name;
 
@@ -70,7 +78,18 @@ public:
     void free_source() noexcept
     { _sources.clear(); }
 
-    void compile();
+    // Starts compilation without waiting for the driver
+    void submit();
+    // Waits for the compilation started by submit() and throws ShaderCompilationError if it failed
+    void finish();
+    // Tells whether finish() would not block; always true without KHR_parallel_shader_compile
+    bool completed() const;
+
+    void compile()
+    {
+        submit();
+        finish();
+    }
 };
 
 class VertexShader : public Shader
@@ -90,18 +109,73 @@ public:
 };
 
 
+// Last value written to a uniform of a program, values larger than a matrix are not kept
+class UniformShadow
+{
+    std::array<std::byte, sizeof(glm::mat4)> _bytes;
+    std::size_t _size = 0;
+
+public:
+    // Stores the value and tells whether it differs from the stored one
+    bool update(const void *value, std::size_t size) noexcept
+    {
+        if (size == _size && std::memcmp(_bytes.data(), value, size) == 0)
+            return false;
+        _size = size <= _bytes.size() ? size : 0;
+        std::memcpy(_bytes.data(), value, _size);
+        return true;
+    }
+};
+
+
+// Uniform name reduced to its FNV-1a hash, computed at compile time for names written as string literals
+class UniformName
+{
+    std::uint32_t _hash;
+
+public:
+    static constexpr std::uint32_t Hash(std::string_view name) noexcept
+    {
+        std::uint32_t hash = 2166136261u;
+        for (char c: name) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    consteval UniformName(const char *name) :
+        _hash(Hash(name))
+    {}
+
+    std::uint32_t hash() const noexcept
+    { return _hash; }
+};
+
+
 class UniformValue
 {
     friend class ShaderProgram;
 
     GLuint _program_id = 0;
     GLint _location = -1;
+    UniformShadow *_shadow = nullptr;
 
-    UniformValue(GLuint program, GLint location) :
+    UniformValue(GLuint program, GLint location, UniformShadow *shadow) :
         _program_id(program),
-        _location(location)
+        _location(location),
+        _shadow(shadow)
     {}
 
+    // Writes of unused uniforms and of values the uniform already holds are skipped
+    template<class T>
+    bool _changes(const T &value)
+    {
+        const bool changed = _location >= 0 && (!_shadow || _shadow->update(&value, sizeof(T)));
+        State::Current().count_uniform(changed);
+        return changed;
+    }
+
 public:
     UniformValue() = default;
     void operator=(const UniformValue &other) = delete;
@@ -110,26 +184,47 @@ public:
     { return _location; }
 
     void operator=(int v)
-    { glUniform1i(_location, v); }
+    {
+        if (_changes(v))
+            glUniform1i(_location, v);
+    }
 
     void operator=(float v)
-    { glUniform1f(_location, v); }
+    {
+        if (_changes(v))
+            glUniform1f(_location, v);
+    }
 
     void operator=(const glm::vec2 &v)
-    { glUniform2f(_location, v[0], v[1]); }
+    {
+        if (_changes(v))
+            glUniform2f(_location, v[0], v[1]);
+    }
 
     void operator=(const glm::vec3 &v)
-    { glUniform3f(_location, v[0], v[1], v[2]); }
+    {
+        if (_changes(v))
+            glUniform3f(_location, v[0], v[1], v[2]);
+    }
 
     void operator=(const glm::vec4 &v)
-    { glUniform4f(_location, v[0], v[1], v[2], v[3]); }
+    {
+        if (_changes(v))
+            glUniform4f(_location, v[0], v[1], v[2], v[3]);
+    }
 
     void operator=(const glm::mat4 &v)
-    { glUniformMatrix4fv(_location, 1, GL_FALSE, glm::value_ptr(v)); }
+    {
+        if (_changes(v))
+            glUniformMatrix4fv(_location, 1, GL_FALSE, glm::value_ptr(v));
+    }
 
     template<size_t N>
     void operator=(const std::array<GLint, N> &v)
-    { glUniform1iv(_location, N, v.data()); }
+    {
+        if (_changes(v))
+            glUniform1iv(_location, N, v.data());
+    }
 };
 
 class ShaderProgram
@@ -137,6 +232,16 @@ class ShaderProgram
     GLuint _id = 0;
     std::string _log;
     bool _linked = false;
+    bool _pending = false;
+    struct Uniform
+    {
+        GLint location;
+        UniformShadow shadow;
+    };
+    // Active uniforms by name hash, filled in when the program is linked
+    std::unordered_map<std::uint32_t, Uniform> _uniforms;
+
+    void _load_uniforms();
 
 public:
     ShaderProgram() = default;
@@ -160,13 +265,33 @@ public:
     void attach(const Shader &shader);
     void detach(const Shader &shader);
 
-    void link();
+    // Starts linking the attached shaders without waiting for the driver
+    void submit_link();
+    // Waits for the link started by submit_link() and throws ShaderCompilationError if it failed
+    void finish_link();
+    // Tells whether finish_link() would not block; always true without KHR_parallel_shader_compile
+    bool completed() const;
+
+    void link()
+    {
+        submit_link();
+        finish_link();
+    }
+    // Links the program from a binary returned by binary(), false if the driver does not accept it
+    bool link_binary(GLenum format, const void *data, GLsizei length);
+    // Binary of the linked program to be given to link_binary() later
+    std::vector<std::byte> binary(GLenum &format) const;
+
+    // Binds the uniform block to the binding point, programs without such block are left as they are
+    void bind_uniform_block(const char *block_name, GLuint binding);
 
-    UniformValue operator[](const char *uniform_name)
+    // Uniforms that are not active in the program give values ignoring all writes
+    UniformValue operator[](UniformName name)
     {
-        auto location = glGetUniformLocation(_id, uniform_name);
-        GLError::RaiseIfError();
-        return UniformValue(_id, location);
+        const auto it = _uniforms.find(name.hash());
+        if (it == _uniforms.end())
+            return UniformValue(_id, -1, nullptr);
+        return UniformValue(_id, it->second.location, &it->second.shadow);
     }
 };
 
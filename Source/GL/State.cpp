@@ -0,0 +1,139 @@
+#include <algorithm>
+#include "State.hpp"
+
+namespace GL {
+
+State &State::Current()
+{
+    static State state;
+    return state;
+}
+
+void State::invalidate() noexcept
+{
+    _program = _vertex_array = _active_unit = UNKNOWN;
+    for (auto &unit: _textures)
+        std::fill(std::begin(unit), std::end(unit), UNKNOWN);
+    std::fill(std::begin(_capabilities), std::end(_capabilities), UNKNOWN);
+    _depth_mask = _color_mask = UNKNOWN;
+    _blend_source = _blend_destination = UNKNOWN;
+    _polygon_mode = UNKNOWN;
+}
+
+void State::use_program(GLuint program)
+{
+    if (_count(program != _program))
+        glUseProgram(_program = program);
+}
+
+void State::bind_vertex_array(GLuint vertex_array)
+{
+    if (_count(vertex_array != _vertex_array))
+        glBindVertexArray(_vertex_array = vertex_array);
+}
+
+void State::_active_texture(unsigned unit)
+{
+    if (_count(unit != _active_unit))
+        glActiveTexture(GL_TEXTURE0 + (_active_unit = unit));
+}
+
+void State::bind_texture(unsigned unit, GLenum target, GLuint texture)
+{
+    const auto target_it = std::find(std::begin(TEXTURE_TARGETS), std::end(TEXTURE_TARGETS), target);
+    if (unit >= TEXTURE_UNITS || target_it == std::end(TEXTURE_TARGETS)) {
+        _active_texture(unit);
+        _count(true);
+        glBindTexture(target, texture);
+        return;
+    }
+    auto &bound = _textures[unit][target_it - std::begin(TEXTURE_TARGETS)];
+    if (!_count(texture != bound))
+        return;
+    _active_texture(unit);
+    glBindTexture(target, bound = texture);
+}
+
+void State::set_capability(GLenum capability, bool enabled)
+{
+    const auto it = std::find(std::begin(CAPABILITIES), std::end(CAPABILITIES), capability);
+    if (it != std::end(CAPABILITIES)) {
+        auto &current = _capabilities[it - std::begin(CAPABILITIES)];
+        if (!_count(current != GLuint(enabled)))
+            return;
+        current = enabled;
+    } else {
+        _count(true);
+    }
+    if (enabled)
+        glEnable(capability);
+    else
+        glDisable(capability);
+}
+
+bool State::capability(GLenum capability)
+{
+    const auto it = std::find(std::begin(CAPABILITIES), std::end(CAPABILITIES), capability);
+    if (it == std::end(CAPABILITIES))
+        return glIsEnabled(capability);
+    auto &current = _capabilities[it - std::begin(CAPABILITIES)];
+    if (current == UNKNOWN)
+        current = glIsEnabled(capability);
+    return current;
+}
+
+void State::depth_mask(bool write)
+{
+    if (_count(_depth_mask != GLuint(write)))
+        glDepthMask((_depth_mask = write) ? GL_TRUE : GL_FALSE);
+}
+
+void State::color_mask(bool write)
+{
+    if (!_count(_color_mask != GLuint(write)))
+        return;
+    const GLboolean value = (_color_mask = write) ? GL_TRUE : GL_FALSE;
+    glColorMask(value, value, value, value);
+}
+
+void State::blend_func(GLenum source, GLenum destination)
+{
+    if (_count(source != _blend_source || destination != _blend_destination))
+        glBlendFunc(_blend_source = source, _blend_destination = destination);
+}
+
+void State::polygon_mode(GLenum mode)
+{
+    if (_count(mode != _polygon_mode))
+        glPolygonMode(GL_FRONT_AND_BACK, _polygon_mode = mode);
+}
+
+GLenum State::polygon_mode()
+{
+    if (_polygon_mode == UNKNOWN) {
+        GLint modes[2];
+        glGetIntegerv(GL_POLYGON_MODE, modes);
+        _polygon_mode = modes[0];
+    }
+    return _polygon_mode;
+}
+
+void State::forget_program(GLuint program) noexcept
+{
+    if (_program == program)
+        _program = UNKNOWN;
+}
+
+void State::forget_vertex_array(GLuint vertex_array) noexcept
+{
+    if (_vertex_array == vertex_array)
+        _vertex_array = UNKNOWN;
+}
+
+void State::forget_texture(GLuint texture) noexcept
+{
+    for (auto &unit: _textures)
+        std::replace(std::begin(unit), std::end(unit), texture, UNKNOWN);
+}
+
+}
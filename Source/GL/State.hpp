@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <iterator>
+#include <GL/glew.h>
+
+namespace GL {
+
+// Shadow copy of the context state that is rebound most often: program, vertex array, textures of the first
+// TEXTURE_UNITS units, a few capabilities, depth and colour masks, the blend function and the polygon mode. Calls that would not change
+// anything are skipped. State changed by direct GL calls has to be forgotten with invalidate(), and deleted objects
+// with the forget_*() functions, since their names may be reused.
+class State
+{
+public:
+    static constexpr unsigned TEXTURE_UNITS = 8;
+
+    struct Counters
+    {
+        std::uint64_t issued = 0;
+        std::uint64_t skipped = 0;
+    };
+
+private:
+    static constexpr GLuint UNKNOWN = ~0u;
+    static constexpr GLenum TEXTURE_TARGETS[] = {GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BUFFER};
+    static constexpr GLenum CAPABILITIES[] = {GL_BLEND, GL_CULL_FACE, GL_DEPTH_TEST};
+
+    GLuint _program;
+    GLuint _vertex_array;
+    GLuint _active_unit;
+    GLuint _textures[TEXTURE_UNITS][std::size(TEXTURE_TARGETS)];
+    // 0 or 1, UNKNOWN until set or queried
+    GLuint _capabilities[std::size(CAPABILITIES)];
+    GLuint _depth_mask, _color_mask;
+    GLenum _blend_source, _blend_destination;
+    // Same mode for front and back faces
+    GLenum _polygon_mode;
+    Counters _counters;
+
+    bool _count(bool changed) noexcept
+    {
+        ++(changed ? _counters.issued : _counters.skipped);
+        return changed;
+    }
+
+    void _active_texture(unsigned unit);
+
+public:
+    // State of the only context of the application
+    static State &Current();
+
+    State()
+    { invalidate(); }
+
+    void invalidate() noexcept;
+
+    void use_program(GLuint program);
+    void bind_vertex_array(GLuint vertex_array);
+    void bind_texture(unsigned unit, GLenum target, GLuint texture);
+    void set_capability(GLenum capability, bool enabled);
+    bool capability(GLenum capability);
+    void depth_mask(bool write);
+    void color_mask(bool write);
+    void blend_func(GLenum source, GLenum destination);
+    void polygon_mode(GLenum mode);
+    GLenum polygon_mode();
+
+    void forget_program(GLuint program) noexcept;
+    void forget_vertex_array(GLuint vertex_array) noexcept;
+    void forget_texture(GLuint texture) noexcept;
+
+    // Uniform writes are filtered by the shadow values of ShaderProgram and only counted here
+    void count_uniform(bool changed) noexcept
+    { _count(changed); }
+
+    const Counters &counters() const noexcept
+    { return _counters; }
+
+    void reset_counters() noexcept
+    { _counters = Counters(); }
+};
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "Misc.hpp"
+
+namespace GL {
+
+// Buffer with a single value of T, laid out to match a std140 uniform block, attached to a fixed binding point
+template<class T>
+class UniformBuffer
+{
+    GLuint _id = 0;
+    GLuint _binding;
+
+public:
+    explicit UniformBuffer(GLuint binding) :
+        _binding(binding)
+    {}
+
+    UniformBuffer(const UniformBuffer &other) = delete;
+
+    ~UniformBuffer()
+    { release(); }
+
+    GLuint binding() const noexcept
+    { return _binding; }
+
+    void update(const T &value)
+    {
+        if (!_id) {
+            glGenBuffers(1, &_id);
+            glBindBuffer(GL_UNIFORM_BUFFER, _id);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+            glBindBufferBase(GL_UNIFORM_BUFFER, _binding, _id);
+        } else {
+            glBindBuffer(GL_UNIFORM_BUFFER, _id);
+        }
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &value);
+        GLError::RaiseIfError();
+    }
+
+    void release() noexcept
+    {
+        if (_id) {
+            glDeleteBuffers(1, &_id);
+            _id = 0;
+        }
+    }
+};
+
+}
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include "JobSystem.hpp"
+
+
+JobSystem::JobSystem(unsigned threads)
+{
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency() - 1);
+    for (unsigned i = 0; i < threads; ++i)
+        _workers.push_back(std::make_unique<Worker>());
+    for (unsigned i = 0; i < threads; ++i)
+        _threads.emplace_back(&JobSystem::_run, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard lock(_sleep_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto &thread: _threads)
+        thread.join();
+}
+
+void JobSystem::submit(Job job, float priority)
+{
+    auto &worker = *_workers[_next_worker.fetch_add(1, std::memory_order_relaxed) % _workers.size()];
+    {
+        std::lock_guard lock(worker.mutex);
+        // Counted before the task can be taken, so the decrement of whoever takes it never comes first
+        _queued.fetch_add(1, std::memory_order_release);
+        auto position = std::upper_bound(worker.tasks.begin(), worker.tasks.end(), priority,
+                                         [](float p, const Task &task) { return p < task.priority; });
+        worker.tasks.insert(position, {priority, std::move(job)});
+    }
+    // Taking the mutex orders this notification after a sleeping worker has checked its wait condition
+    { std::lock_guard lock(_sleep_mutex); }
+    _wake.notify_one();
+}
+
+bool JobSystem::_pop(unsigned index, Task &task)
+{
+    auto &worker = *_workers[index];
+    std::lock_guard lock(worker.mutex);
+    if (worker.tasks.empty())
+        return false;
+    task = std::move(worker.tasks.front());
+    worker.tasks.pop_front();
+    return true;
+}
+
+bool JobSystem::_steal(unsigned thief, Task &task)
+{
+    for (unsigned i = 1; i < _workers.size(); ++i) {
+        auto &victim = *_workers[(thief + i) % _workers.size()];
+        std::unique_lock lock(victim.mutex, std::try_to_lock);
+        if (!lock || victim.tasks.empty())
+            continue;
+        task = std::move(victim.tasks.back());
+        victim.tasks.pop_back();
+        return true;
+    }
+    return false;
+}
+
+void JobSystem::_run(unsigned index)
+{
+    while (true) {
+        Task task;
+        if (_pop(index, task) || _steal(index, task)) {
+            _queued.fetch_sub(1, std::memory_order_relaxed);
+            task.job();
+            continue;
+        }
+
+        std::unique_lock lock(_sleep_mutex);
+        _wake.wait(lock, [this] { return _stop || _queued.load(std::memory_order_acquire) > 0; });
+        if (_stop)
+            return;
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Pool of worker threads running jobs in priority order. Every worker owns a queue sorted by priority; it takes its
+// most urgent job from the front and, when its queue is empty, steals the least urgent job from the back of another
+// worker's queue. Jobs that are still queued when the pool is destroyed are dropped.
+class JobSystem
+{
+public:
+    using Job = std::function<void()>;
+
+private:
+    struct Task
+    {
+        float priority;
+        Job job;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+    std::mutex _sleep_mutex;
+    std::condition_variable _wake;
+    std::atomic<std::size_t> _queued = 0;
+    std::atomic<unsigned> _next_worker = 0;
+    std::atomic<bool> _stop = false;
+
+    bool _pop(unsigned index, Task &task);
+    bool _steal(unsigned thief, Task &task);
+    void _run(unsigned index);
+
+public:
+    // Zero threads means one less than the number of hardware threads, leaving one for the main thread
+    explicit JobSystem(unsigned threads = 0);
+    JobSystem(const JobSystem &other) = delete;
+    ~JobSystem();
+
+    unsigned thread_count() const noexcept
+    { return static_cast<unsigned>(_threads.size()); }
+
+    std::size_t queued() const noexcept
+    { return _queued.load(std::memory_order_relaxed); }
+
+    // Jobs with lower priority value run first
+    void submit(Job job, float priority = 0);
+};
@@ -5,110 +5,77 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/norm.hpp>
 #include <map>
+#include <optional>
+#include "GL/Debug.hpp"
+#include "GL/GLSL/Types.hpp"
+#include "GL/ProgramCache.hpp"
+#include "GL/ShaderBatch.hpp"
 #include "GL/Shaders.hpp"
+#include "GL/UniformBuffer.hpp"
 #include "VoxelGrid.hpp"
 #include "AssetsRegister.hpp"
+#include "FrameProfiler.hpp"
+#include "JobSystem.hpp"
+#include "RegionFile.hpp"
+#include "SpriteBatch.hpp"
+#include "WorldRenderer.hpp"
 
 
 struct Config
 {
     bool print_system_info = true;
+    // Debug context reporting GL errors and warnings through a callback
+#ifdef NDEBUG
+    bool gl_debug_output = false;
+#else
+    bool gl_debug_output = true;
+#endif
 
     int antialiasing = 4;
     int resolution_width = 1366;
     int resolution_height = 768;
     float field_of_view = 45.0;
     bool fullscreen = false;
+    bool greedy_meshing = true;
+    // Skip chunks whose bounding boxes were hidden behind other chunks in the previous frame
+    bool occlusion_culling = true;
+    // Zero uses all hardware threads but one
+    unsigned worker_threads = 0;
 
     struct {
         int x0 = -20, x1 = 21;
         int z0 = -20, z1 = 21;
     } world_bounds;
 
-    std::filesystem::path resource_root = "/home/quazyrog/Desktop/OpenGL_/Resources";
-};
+    // Unbounded world keeps only chunks within view_radius chunks from the camera loaded
+    bool unbounded_world = false;
+    int view_radius = 8;
+    int ground_level = -16;
 
-namespace Cube {
-struct Vertex
-{
-    glm::vec3 position;
-    glm::vec2 tex_coord;
-    GLint face_index;
-};
-constexpr Vertex VERTICES[] = {
-    // Front face
-    {{-1, -1, +1}, {0, 1}, 0},
-    {{+1, -1, +1}, {1, 1}, 0},
-    {{-1, +1, +1}, {0, 0}, 0},
-    {{+1, +1, +1}, {1, 0}, 0},
-
-    // Back face
-    {{+1, -1, -1}, {0, 1}, 1},
-    {{-1, -1, -1}, {1, 1}, 1},
-    {{+1, +1, -1}, {0, 0}, 1},
-    {{-1, +1, -1}, {1, 0}, 1},
-
-    // Left face
-    {{-1, -1, -1}, {0, 1}, 2},
-    {{-1, -1, +1}, {1, 1}, 2},
-    {{-1, +1, -1}, {0, 0}, 2},
-    {{-1, +1, +1}, {1, 0}, 2},
-
-    // Right face
-    {{+1, -1, +1}, {0, 1}, 3},
-    {{+1, -1, -1}, {1, 1}, 3},
-    {{+1, +1, +1}, {0, 0}, 3},
-    {{+1, +1, -1}, {1, 0}, 3},
-
-    // Bottom face
-    {{-1, -1, -1}, {0, 1}, 4},
-    {{+1, -1, -1}, {1, 1}, 4},
-    {{-1, -1, +1}, {0, 0}, 4},
-    {{+1, -1, +1}, {1, 0}, 4},
-
-    // Top face
-    {{-1, +1, +1}, {0, 1}, 5},
-    {{+1, +1, +1}, {1, 1}, 5},
-    {{-1, +1, -1}, {0, 0}, 5},
-    {{+1, +1, -1}, {1, 0}, 5},
-};
-GLuint INDICES[] = {
-     0,  1,  2,   2,  1,  3,
-     4,  5,  6,   6,  5,  7,
-     8,  9, 10,  10,  9, 11,
-    12, 13, 14,  14, 13, 15,
-    16, 17, 18,  18, 17, 19,
-    20, 21, 22,  22, 21, 23
-};
-}
-constexpr GLfloat FLOOR_VERTICES[] = {
-    -1.0, -1.0,  -1.0, +1.0,
-    -0.5, -1.0,  -0.5, +1.0,
-     0.0, -1.0,   0.0, +1.0,
-    +0.5, -1.0,  +0.5, +1.0,
-    +1.0, -1.0,  +1.0, +1.0,
-
-    -1.0, -1.0,  +1.0, -1.0,
-    -1.0, -0.5,  +1.0, -0.5,
-    -1.0,  0.0,  +1.0,  0.0,
-    -1.0, +0.5,  +1.0, +0.5,
-    -1.0, +1.0,  +1.0, +1.0,
-};
-constexpr GLfloat UI_VERTICES[] = {
-    -0.05, -0.05, 0.0,   0.0, 0.0,
-     0.05, -0.05, 0.0,   1.0, 0.0,
-    -0.05,  0.05, 0.0,   0.0, 1.0,
-     0.05,  0.05, 0.0,   1.0, 1.0,
-};
+    // Region files the world is loaded from and saved to, no persistence if empty
+    std::filesystem::path world_directory;
+
+    // CPU and GPU times of the passes of recent frames, printed with F3 and saved to trace_file with F4
+    bool frame_profiler = true;
+    std::filesystem::path trace_file = "frame_trace.json";
 
+    // Linked shader programs kept between runs, no caching if empty
+    std::filesystem::path shader_cache_directory = std::filesystem::temp_directory_path() / "yaogls-shader-cache";
+
+    std::filesystem::path resource_root = "/home/quazyrog/Desktop/OpenGL_/Resources";
+};
 
 VoxelGrid Grid(48, 24, 48, -24, -8, -24);
+WorldRenderer GridRenderer(Grid);
+FrameProfiler Profiler;
+bool TraceRequested = false;
 glm::mat4 ProjectionMatrix;
 GLFWwindow *MainWindow;
 struct ControlState {
     bool wireframe_mode = false;
     bool cursor_locked = false;
     bool cull_face = true;
+    bool instanced_rendering = false;
 
     bool operator==(const ControlState &other) const = default;
     bool operator!=(const ControlState &other) const = default;
@@ -147,6 +114,8 @@ struct CameraState {
     }
 } CameraState;
 float ScreenRatio;
+// Vertical field of view in degrees, Config::field_of_view of the running configuration
+float FieldOfView = 45.0f;
 
 
 void PrintSystemInfo()
@@ -165,7 +134,8 @@ void WindowResizeCallback(GLFWwindow* window, int width, int height)
 {
     glViewport(0, 0, width, height);
     ScreenRatio = (float)width / (float)height;
-    ProjectionMatrix = glm::perspective(glm::radians(45.0f), ScreenRatio, 0.1f, 500.0f);
+    ProjectionMatrix = glm::perspective(glm::radians(FieldOfView), ScreenRatio, 0.1f, 500.0f);
+    GridRenderer.set_lod_focal_length(height / (2 * std::tan(glm::radians(FieldOfView) / 2)));
 }
 
 void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods)
@@ -179,6 +149,15 @@ void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mods
             ControlState.wireframe_mode = !ControlState.wireframe_mode;
             ControlState.cull_face = !ControlState.wireframe_mode;
             break;
+        case GLFW_KEY_F2:
+            ControlState.instanced_rendering = !ControlState.instanced_rendering;
+            break;
+        case GLFW_KEY_F3:
+            Profiler.print_statistics(std::cout);
+            break;
+        case GLFW_KEY_F4:
+            TraceRequested = true;
+            break;
 
         // Arrows
         case GLFW_KEY_W:
@@ -260,7 +239,7 @@ void MouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
                 }
             }
             if (r.hit || r.voxel_y == Grid.min_y())
-                Grid(r.voxel_x, r.voxel_y, r.voxel_z).block_id = 1;
+                Grid.set(r.voxel_x, r.voxel_y, r.voxel_z, {1});
         }
     } else {
         if (button == GLFW_MOUSE_BUTTON_LEFT || button == GLFW_MOUSE_BUTTON_RIGHT)
@@ -290,12 +269,14 @@ GLFWwindow *InitMainWindow(const char *title, Config config)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, config.gl_debug_output ? GL_TRUE : GL_FALSE);
     GLFWwindow* window = glfwCreateWindow(config.resolution_width, config.resolution_height, title, monitor, nullptr);
     if (!window) {
         glfwTerminate();
         throw GL::Error("unable to create main window");
     }
 
+    FieldOfView = config.field_of_view;
     WindowResizeCallback(window, config.resolution_width, config.resolution_height);
     glfwSetWindowSizeCallback(window, WindowResizeCallback);
     glfwSetKeyCallback(window, KeyCallback);
@@ -308,22 +289,44 @@ GLFWwindow *InitMainWindow(const char *title, Config config)
         glfwTerminate();
         throw GL::Error("unable to initialize GLEW");
     }
+    // GLEW may leave GL_INVALID_ENUM behind while probing extensions
+    while (glGetError() != GL_NO_ERROR)
+        continue;
+    if (config.gl_debug_output && !GL::DebugOutput::Enable())
+        std::cerr << "WARNING: debug output is not supported by the context" << std::endl;
 
     return window;
 }
 
 
-auto CompileShader(const std::filesystem::path& vsh_path, const std::filesystem::path& fsh_path)
+// Loads program from the cache, or submits it to batch and leaves it to be linked by batch.finish(); cache has to
+// outlive the batch
+void CompileShader(GL::ShaderBatch &batch, const GL::ProgramCache &cache, GL::ShaderProgram &program,
+                   const std::filesystem::path& vsh_path, const std::filesystem::path& fsh_path)
 {
-    GL::ShaderProgram program;
-    auto vertex_shader = GL::Shader::FromSourceFile<GL::VertexShader>(vsh_path);
-    program.attach(vertex_shader);
-    auto fragment_shader = GL::Shader::FromSourceFile<GL::FragmentShader>(fsh_path);
-    program.attach(fragment_shader);
-    program.link();
-    program.detach(fragment_shader);
-    program.detach(vertex_shader);
-    return program;
+    auto vertex_source = GL::ReadFile(vsh_path);
+    auto fragment_source = GL::ReadFile(fsh_path);
+    const auto key = cache.key({vertex_source, fragment_source});
+    // Block bindings are not part of the binary
+    const auto bind_blocks = [](GL::ShaderProgram &linked) {
+        linked.bind_uniform_block(GL::GLSL::Camera::BLOCK_NAME, GL::GLSL::Camera::BINDING);
+    };
+    if (cache.load(key, program)) {
+        bind_blocks(program);
+        return;
+    }
+
+    std::vector<GL::Shader> shaders;
+    GL::VertexShader vertex_shader(vsh_path.filename().string());
+    vertex_shader.add_source(std::move(vertex_source));
+    shaders.push_back(std::move(vertex_shader));
+    GL::FragmentShader fragment_shader(fsh_path.filename().string());
+    fragment_shader.add_source(std::move(fragment_source));
+    shaders.push_back(std::move(fragment_shader));
+    batch.add(program, std::move(shaders), [&cache, key, bind_blocks](GL::ShaderProgram &linked) {
+        cache.store(key, linked);
+        bind_blocks(linked);
+    });
 }
 
 
@@ -334,12 +337,11 @@ void ApplyControlState()
         return;
     current_control_state = ControlState;
 
-    glPolygonMode(GL_FRONT_AND_BACK, ControlState.wireframe_mode ? GL_LINE : GL_FILL);
+    auto &state = GL::State::Current();
+    state.polygon_mode(ControlState.wireframe_mode ? GL_LINE : GL_FILL);
+    state.set_capability(GL_CULL_FACE, ControlState.cull_face);
 
-    if (ControlState.cull_face)
-        glEnable(GL_CULL_FACE);
-    else
-        glDisable(GL_CULL_FACE);
+    GridRenderer.set_instanced(ControlState.instanced_rendering);
 
     if (ControlState.cursor_locked)
         glfwSetInputMode(MainWindow, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -351,9 +353,34 @@ int main(void)
 {
     Config config;
     AssetsRegister assets;
+    // Declared after the assets, so that workers still building meshes are joined before the assets are destroyed
+    JobSystem jobs(config.worker_threads);
+
+    std::optional<WorldStorage> storage;
+    if (!config.world_directory.empty())
+        storage.emplace(config.world_directory);
+
+    if (config.unbounded_world) {
+        Grid = VoxelGrid::Unbounded();
+        Grid.set_chunk_loader([&config, &storage](glm::ivec3 chunk_pos, VoxelGrid::Chunk &chunk) {
+            if (storage && storage->load(chunk_pos, chunk))
+                return;
+            if (Grid.chunk_origin(chunk_pos).y + VoxelGrid::Chunk::SIZE <= config.ground_level)
+                chunk.fill({3});
+        });
+        if (storage) {
+            Grid.set_chunk_unloader([&storage](glm::ivec3 chunk_pos, VoxelGrid::Chunk &chunk) {
+                storage->save(chunk_pos, chunk);
+            });
+        }
+    } else if (storage) {
+        storage->load_grid(Grid);
+    }
 
-    for (int z = -4; z < 15; ++z)
-        Grid(0, -6, z).block_id = 1 + (abs(z) % 4);
+    if (!storage) {
+        for (int z = -4; z < 15; ++z)
+            Grid.set(0, -6, z, {1u + abs(z) % 4});
+    }
 
     try {
         MainWindow = InitMainWindow("Hello World", config);
@@ -365,88 +392,40 @@ int main(void)
     if (config.print_system_info)
         PrintSystemInfo();
 
-    assets.read_pack(config.resource_root / "AssetsPack" / "MANIFEST.yml");
+    // Compiled by the driver while the assets are loaded
+    GL::ShaderProgram cube_shader, instanced_cube_shader, occlusion_shader, floor_shader, ui_shader;
+    const GL::ProgramCache shader_cache(config.shader_cache_directory);
+    GL::ShaderBatch shader_batch;
+    const auto shaders_path = config.resource_root / "Shaders";
+    CompileShader(shader_batch, shader_cache, cube_shader, shaders_path / "Voxel.vert", shaders_path / "Voxel.frag");
+    CompileShader(shader_batch, shader_cache, instanced_cube_shader, shaders_path / "VoxelInstanced.vert",
+                  shaders_path / "Voxel.frag");
+    CompileShader(shader_batch, shader_cache, occlusion_shader, shaders_path / "OcclusionBox.vert",
+                  shaders_path / "OcclusionBox.frag");
+    CompileShader(shader_batch, shader_cache, floor_shader, shaders_path / "Floor.vert", shaders_path / "Floor.frag");
+    CompileShader(shader_batch, shader_cache, ui_shader, shaders_path / "UI.vert", shaders_path / "UI.frag");
 
-    GLuint cube_vao;
-    {
-        glGenVertexArrays(1, &cube_vao);
-        glBindVertexArray(cube_vao);
-
-        GLuint vbo;
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(Cube::VERTICES), Cube::VERTICES, GL_STATIC_DRAW);
-
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Cube::Vertex), (void*)offsetof(Cube::Vertex, position));
-        glEnableVertexAttribArray(0);
-        glVertexAttribIPointer(1, 1, GL_INT, sizeof(Cube::Vertex), (void*)offsetof(Cube::Vertex, face_index));
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Cube::Vertex), (void*)offsetof(Cube::Vertex, tex_coord));
-        glEnableVertexAttribArray(2);
-
-        GLuint ebo;
-        glGenBuffers(1, &ebo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Cube::INDICES), Cube::INDICES, GL_STATIC_DRAW);
-
-        glBindVertexArray(0);
-        GL::GLError::RaiseIfError();
-    }
+    assets.read_pack(config.resource_root / "AssetsPack" / "MANIFEST.yml");
+    GridRenderer.set_greedy_meshing(config.greedy_meshing);
+    GridRenderer.set_job_system(&jobs);
+    GridRenderer.set_occlusion_culling(config.occlusion_culling);
 
+    // The floor shader makes its vertices from gl_VertexID, but the core profile cannot draw without a vertex array
     GLuint floor_vao;
-    {
-        glGenVertexArrays(1, &floor_vao);
-        glBindVertexArray(floor_vao);
-        GL::GLError::RaiseIfError();
-
-        GLuint vbo;
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(FLOOR_VERTICES), FLOOR_VERTICES, GL_STATIC_DRAW);
-        GL::GLError::RaiseIfError();
-
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void *) 0);
-        glEnableVertexAttribArray(0);
-        GL::GLError::RaiseIfError();
-
-        glBindVertexArray(0);
-    }
-
-    GLuint ui_vao;
-    {
-        glGenVertexArrays(1, &ui_vao);
-        glBindVertexArray(ui_vao);
-        GL::GLError::RaiseIfError();
-
-        GLuint vbo;
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(UI_VERTICES), UI_VERTICES, GL_STATIC_DRAW);
-        GL::GLError::RaiseIfError();
-
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void *) 0);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void *) (3 * sizeof(GLfloat)));
-        glEnableVertexAttribArray(1);
-        GL::GLError::RaiseIfError();
-
-        glBindVertexArray(0);
-    }
+    glGenVertexArrays(1, &floor_vao);
+    GL::GLError::RaiseIfError();
+    SpriteBatch hud;
 
     auto indicator_texture = GL::LoadTextureImage(config.resource_root / "Textures" / "sight.png");
-    glBindTexture(GL_TEXTURE_2D, indicator_texture);
+    GL::State::Current().bind_texture(0, GL_TEXTURE_2D, indicator_texture);
     glGenerateMipmap(GL_TEXTURE_2D);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
     GL::GLError::RaiseIfError();
 
 
-    GL::ShaderProgram cube_shader, floor_shader, ui_shader;
     try {
-        auto shaders_path = config.resource_root / "Shaders";
-        cube_shader = CompileShader(shaders_path / "Voxel.vert", shaders_path / "Voxel.frag");
-        floor_shader = CompileShader(shaders_path / "Floor.vert", shaders_path / "Floor.frag");
-        ui_shader = CompileShader(shaders_path / "UI.vert", shaders_path / "UI.frag");
+        shader_batch.finish();
     } catch (GL::ShaderCompilationError &e) {
         std::cerr << e.what() << ": " << e.message() << "\n";
         for (auto c: e.compilation_log()) {
@@ -459,71 +438,97 @@ int main(void)
         return 1;
     }
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    GL::UniformBuffer<GL::GLSL::Camera> camera_uniforms(GL::GLSL::Camera::BINDING);
+    auto &state = GL::State::Current();
+    state.set_capability(GL_DEPTH_TEST, true);
+    state.set_capability(GL_BLEND, true);
+    state.blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glClearColor(0, 0, 0, 0);
+    Profiler.set_enabled(config.frame_profiler);
+    const auto input_pass = Profiler.add_pass("input", false);
+    const auto update_pass = Profiler.add_pass("update", true);
+    const auto voxel_pass = Profiler.add_pass("voxel", true);
+    const auto floor_pass = Profiler.add_pass("floor", true);
+    const auto ui_pass = Profiler.add_pass("ui", true);
+    const auto swap_pass = Profiler.add_pass("swap", false);
     while (!glfwWindowShouldClose(MainWindow)) {
-        ApplyControlState();
-        CameraState.move(0.025);
+        Profiler.begin_frame();
+        {
+            FrameProfiler::Scope pass(Profiler, input_pass);
+            glfwPollEvents();
+            ApplyControlState();
+            CameraState.move(0.025);
+        }
+        if (TraceRequested) {
+            Profiler.write_trace(config.trace_file);
+            std::cout << "Frame trace written to " << config.trace_file << std::endl;
+            TraceRequested = false;
+        }
+
+        {
+            FrameProfiler::Scope pass(Profiler, update_pass);
+            Grid.stream(CameraState.position, config.view_radius);
+            if (storage && config.unbounded_world)
+                storage->evict(Grid.stream_center(), config.view_radius);
+            for (const auto chunk_pos: Grid.drain_dirty_chunks())
+                GridRenderer.invalidate_chunk(chunk_pos);
+            GridRenderer.update(assets, CameraState.position);
+        }
+
         auto view_matrix = CameraState.compute_view_matrix();
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        glUseProgram(cube_shader.id());
-        glBindVertexArray(cube_vao);
-        cube_shader["ModelMatrix"] = glm::scale(glm::translate(glm::mat4(1.0), glm::vec3(0.5)), glm::vec3(0.5));
-        cube_shader["ViewMatrix"] = view_matrix;
-        cube_shader["ProjectionMatrix"] = ProjectionMatrix;
-        auto attr_position = cube_shader["Position"];
-        auto attr_atlas = cube_shader["AtlasArray"];
-        auto attr_textures = cube_shader["FaceTextures"];
-        for (int x = Grid.min_x(); x < Grid.max_x(); ++x) {
-            for (int y = Grid.min_y(); y < Grid.max_y(); ++y) {
-                for (int z = Grid.min_z(); z < Grid.max_z(); ++z) {
-                    const auto &voxel = Grid(x, y, z);
-                    if (voxel.block_id == 0)
-                        continue;
-                    const auto &block_model = assets.block_by_id(voxel.block_id);
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D_ARRAY, block_model.used_texture_array_id());
-                    attr_atlas = 0;
-                    attr_textures = block_model.faces_textures_indices();
-                    GL::GLError::RaiseIfError();
-                    attr_position = glm::vec3(x, y, z);
-                    glDrawElements(GL_TRIANGLES, 12 * 3, GL_UNSIGNED_INT, nullptr);
-                }
-            }
+        {
+            FrameProfiler::Scope pass(Profiler, voxel_pass);
+            camera_uniforms.update({view_matrix, ProjectionMatrix});
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            auto &voxel_shader = GridRenderer.instanced() ? instanced_cube_shader : cube_shader;
+            state.use_program(voxel_shader.id());
+            GridRenderer.draw(voxel_shader, assets, Frustum(ProjectionMatrix * view_matrix));
+            state.use_program(occlusion_shader.id());
+            GridRenderer.draw_occlusion_queries(occlusion_shader);
         }
-        GL::GLError::RaiseIfError();
-
-        glUseProgram(floor_shader.id());
-        glBindVertexArray(floor_vao);
-        floor_shader["ViewMatrix"] = view_matrix;
-        floor_shader["ProjectionMatrix"] = ProjectionMatrix;
-        auto fpos = floor_shader["Position"];
-        for (int x = Grid.min_x(); x < Grid.max_x(); ++x) {
-            for (int z = Grid.min_z(); z < Grid.max_z(); ++z) {
-                fpos = glm::vec3(x, Grid.min_y(), z);
-                glDrawArrays(GL_LINES, 0, 20);
-            }
+
+        if (Grid.bounded()) {
+            FrameProfiler::Scope pass(Profiler, floor_pass);
+            GL::DebugScope scope("floor");
+            state.use_program(floor_shader.id());
+            state.bind_vertex_array(floor_vao);
+            floor_shader["FloorMin"] = glm::vec3(Grid.min_x(), Grid.min_y(), Grid.min_z());
+            floor_shader["FloorMax"] = glm::vec2(Grid.max_x(), Grid.max_z());
+            // The grid lines are seen from below as well
+            state.set_capability(GL_CULL_FACE, false);
+            glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            state.set_capability(GL_CULL_FACE, ControlState.cull_face);
+            GL::GLError::RaiseIfError();
+        }
+
+        {
+            FrameProfiler::Scope pass(Profiler, ui_pass);
+            state.set_capability(GL_DEPTH_TEST, false);
+            state.use_program(ui_shader.id());
+            ui_shader["ScreenRatio"] = ScreenRatio;
+            hud.add(indicator_texture, {-0.05, -0.05}, {0.05, 0.05});
+            hud.flush(ui_shader);
+            state.set_capability(GL_DEPTH_TEST, true);
         }
-        GL::GLError::RaiseIfError();
-
-        glDisable(GL_DEPTH_TEST);
-        glUseProgram(ui_shader.id());
-        ui_shader["ScreenRatio"] = ScreenRatio;
-        glBindVertexArray(ui_vao);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, indicator_texture);
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-        glEnable(GL_DEPTH_TEST);
-        GL::GLError::RaiseIfError();
-
-        glBindVertexArray(0);
-        glfwSwapBuffers(MainWindow);
-        glfwPollEvents();
+
+        {
+            FrameProfiler::Scope pass(Profiler, swap_pass);
+            glfwSwapBuffers(MainWindow);
+        }
+        GL::DebugOutput::RaisePending();
     }
 
+    if (config.print_system_info) {
+        const auto &counters = state.counters();
+        fmt::print("GL state changes issued:  {}, skipped:  {}\n", counters.issued, counters.skipped);
+        Profiler.print_statistics(std::cout);
+    }
+    if (storage)
+        storage->save_grid(Grid);
+    GridRenderer.release();
+    hud.release();
+    camera_uniforms.release();
+    Profiler.release();
     glfwTerminate();
     return 0;
 }
\ No newline at end of file
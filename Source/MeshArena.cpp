@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cassert>
+#include "MeshArena.hpp"
+#include "GL/Misc.hpp"
+#include "GL/State.hpp"
+
+
+FreeList::FreeList(GLsizei capacity) :
+    _capacity(capacity)
+{
+    if (capacity > 0)
+        _free.emplace(0, capacity);
+}
+
+GLsizei FreeList::allocate(GLsizei size)
+{
+    for (auto it = _free.begin(); it != _free.end(); ++it) {
+        if (it->second < size)
+            continue;
+        const auto [offset, free_size] = *it;
+        auto hint = _free.erase(it);
+        if (free_size > size)
+            _free.emplace_hint(hint, offset + size, free_size - size);
+        _used += size;
+        return offset;
+    }
+    return -1;
+}
+
+void FreeList::release(GLsizei offset, GLsizei size)
+{
+    _used -= size;
+    auto next = _free.lower_bound(offset);
+    if (next != _free.end() && next->first == offset + size) {
+        size += next->second;
+        next = _free.erase(next);
+    }
+    if (next != _free.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            previous->second += size;
+            return;
+        }
+    }
+    _free.emplace_hint(next, offset, size);
+}
+
+
+MeshArena::~MeshArena()
+{
+    release();
+}
+
+MeshArena::Handle MeshArena::allocate(GLsizei vertex_count, GLsizei index_count)
+{
+    if (size() >= MAX_HANDLES)
+        throw GL::Error("Mesh arena cannot hold more than {} meshes", MAX_HANDLES);
+    if (!_vao)
+        _rebuild(INITIAL_VERTICES, INITIAL_INDICES);
+
+    auto first_vertex = _vertex_space.allocate(vertex_count);
+    auto first_index = _index_space.allocate(index_count);
+    if (first_vertex < 0 || first_index < 0) {
+        if (first_vertex >= 0)
+            _vertex_space.release(first_vertex, vertex_count);
+        if (first_index >= 0)
+            _index_space.release(first_index, index_count);
+        // Packing the live meshes is enough as long as they take at most three quarters of the buffers
+        const auto grown = [](GLsizei capacity, GLsizei needed) {
+            while (4 * std::int64_t(needed) > 3 * std::int64_t(capacity))
+                capacity *= 2;
+            return capacity;
+        };
+        _rebuild(grown(_vertex_space.capacity(), _vertex_space.used() + vertex_count),
+                 grown(_index_space.capacity(), _index_space.used() + index_count));
+        first_vertex = _vertex_space.allocate(vertex_count);
+        first_index = _index_space.allocate(index_count);
+    }
+
+    Handle handle;
+    if (_free_handles.empty()) {
+        handle = static_cast<Handle>(_allocations.size());
+        _allocations.emplace_back();
+    } else {
+        handle = _free_handles.back();
+        _free_handles.pop_back();
+    }
+    _allocations[handle] = {first_vertex, vertex_count, first_index, index_count, true};
+    return handle;
+}
+
+void MeshArena::upload(Handle handle, std::span<const Vertex> vertices, std::span<const GLuint> indices)
+{
+    const auto &allocation = _allocations[handle];
+    assert(vertices.size() == std::size_t(allocation.vertex_count));
+    assert(indices.size() == std::size_t(allocation.index_count));
+    // The copy targets leave the element buffer binding of whatever vertex array is bound untouched
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.first_vertex * sizeof(Vertex), vertices.size_bytes(),
+                    vertices.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _ebo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.first_index * sizeof(GLuint), indices.size_bytes(),
+                    indices.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    GL::GLError::RaiseIfError();
+}
+
+void MeshArena::free(Handle handle)
+{
+    auto &allocation = _allocations[handle];
+    _vertex_space.release(allocation.first_vertex, allocation.vertex_count);
+    _index_space.release(allocation.first_index, allocation.index_count);
+    allocation = Allocation();
+    _free_handles.push_back(handle);
+}
+
+void MeshArena::_rebuild(GLsizei vertex_capacity, GLsizei index_capacity)
+{
+    GLuint vbo, ebo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, vertex_capacity * sizeof(Vertex), nullptr, GL_DYNAMIC_DRAW);
+    GLsizei packed_vertices = 0;
+    if (_vbo) {
+        glBindBuffer(GL_COPY_READ_BUFFER, _vbo);
+        for (auto &allocation: _allocations) {
+            if (!allocation.live)
+                continue;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, allocation.first_vertex * sizeof(Vertex),
+                                packed_vertices * sizeof(Vertex), allocation.vertex_count * sizeof(Vertex));
+            allocation.first_vertex = packed_vertices;
+            packed_vertices += allocation.vertex_count;
+        }
+    }
+
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+    glBufferData(GL_COPY_WRITE_BUFFER, index_capacity * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+    GLsizei packed_indices = 0;
+    if (_ebo) {
+        // Indices are relative to the first vertex of their mesh, moving the vertices does not change them
+        glBindBuffer(GL_COPY_READ_BUFFER, _ebo);
+        for (auto &allocation: _allocations) {
+            if (!allocation.live)
+                continue;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, allocation.first_index * sizeof(GLuint),
+                                packed_indices * sizeof(GLuint), allocation.index_count * sizeof(GLuint));
+            allocation.first_index = packed_indices;
+            packed_indices += allocation.index_count;
+        }
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    if (_vao) {
+        glDeleteBuffers(1, &_ebo);
+        glDeleteBuffers(1, &_vbo);
+        ++_compactions;
+    } else {
+        glGenVertexArrays(1, &_vao);
+    }
+    _vbo = vbo;
+    _ebo = ebo;
+    GL::State::Current().bind_vertex_array(_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+    glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, sizeof(Vertex), (void*)0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+    GL::State::Current().bind_vertex_array(0);
+    GL::GLError::RaiseIfError();
+
+    _vertex_space = FreeList(vertex_capacity);
+    _vertex_space.allocate(packed_vertices);
+    _index_space = FreeList(index_capacity);
+    _index_space.allocate(packed_indices);
+}
+
+void MeshArena::release() noexcept
+{
+    if (_vao) {
+        glDeleteBuffers(1, &_ebo);
+        glDeleteBuffers(1, &_vbo);
+        GL::State::Current().forget_vertex_array(_vao);
+        glDeleteVertexArrays(1, &_vao);
+        _vao = _vbo = _ebo = 0;
+    }
+    _vertex_space = FreeList();
+    _index_space = FreeList();
+    _allocations.clear();
+    _free_handles.clear();
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <map>
+#include <span>
+#include <vector>
+#include <GL/glew.h>
+#include "ChunkMesher.hpp"
+
+
+// First-fit free list over a buffer of capacity() elements; neighbouring free ranges are merged on release
+class FreeList
+{
+    // Offset -> size of every free range
+    std::map<GLsizei, GLsizei> _free;
+    GLsizei _capacity = 0;
+    GLsizei _used = 0;
+
+public:
+    explicit FreeList(GLsizei capacity = 0);
+
+    GLsizei capacity() const noexcept
+    { return _capacity; }
+
+    GLsizei used() const noexcept
+    { return _used; }
+
+    // Offset of the allocated range, or -1 if no free range is large enough
+    GLsizei allocate(GLsizei size);
+    void release(GLsizei offset, GLsizei size);
+};
+
+
+// Vertices and indices of all chunk meshes in one buffer pair behind a single vertex array, so any number of meshes
+// can be drawn with one bind and glMultiDrawElementsBaseVertex. Indices of a mesh are relative to its first vertex.
+// When no free range is large enough the live meshes are copied, packed together, into new buffers, which are grown
+// if the arena is getting full.
+class MeshArena
+{
+public:
+    using Vertex = ChunkMesh::Vertex;
+    using Handle = unsigned;
+    static constexpr Handle NONE = ~0u;
+    // Handles are stored in the 16 bit chunk_slot of vertices
+    static constexpr Handle MAX_HANDLES = 1u << 16;
+
+    struct Allocation
+    {
+        GLsizei first_vertex = 0, vertex_count = 0;
+        GLsizei first_index = 0, index_count = 0;
+        bool live = false;
+    };
+
+private:
+    GLuint _vao = 0, _vbo = 0, _ebo = 0;
+    FreeList _vertex_space, _index_space;
+    std::vector<Allocation> _allocations;
+    std::vector<Handle> _free_handles;
+    unsigned _compactions = 0;
+
+    void _rebuild(GLsizei vertex_capacity, GLsizei index_capacity);
+
+public:
+    static constexpr GLsizei INITIAL_VERTICES = 1 << 18;
+    static constexpr GLsizei INITIAL_INDICES = 3 << 17;
+
+    MeshArena() = default;
+    MeshArena(const MeshArena &other) = delete;
+    ~MeshArena();
+
+    // Reserves space for a mesh, its contents are written by upload()
+    Handle allocate(GLsizei vertex_count, GLsizei index_count);
+    void upload(Handle handle, std::span<const Vertex> vertices, std::span<const GLuint> indices);
+    void free(Handle handle);
+
+    const Allocation &operator[](Handle handle) const
+    { return _allocations[handle]; }
+
+    GLuint vao() const noexcept
+    { return _vao; }
+
+    std::size_t size() const noexcept
+    { return _allocations.size() - _free_handles.size(); }
+
+    unsigned compactions() const noexcept
+    { return _compactions; }
+
+    void release() noexcept;
+};
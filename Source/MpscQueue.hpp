@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <utility>
+
+
+// Unbounded lock-free queue for many producer threads and a single consumer thread (Vyukov's node based queue).
+// Producers never wait for each other or for the consumer: a push is one atomic exchange and one store.
+template<class T>
+class MpscQueue
+{
+    struct Node
+    {
+        std::atomic<Node *> next = nullptr;
+        T value;
+    };
+
+    alignas(64) std::atomic<Node *> _head;
+    alignas(64) Node *_tail;
+
+public:
+    MpscQueue() :
+        _head(new Node),
+        _tail(_head.load(std::memory_order_relaxed))
+    {}
+
+    MpscQueue(const MpscQueue &other) = delete;
+    MpscQueue &operator=(const MpscQueue &other) = delete;
+
+    ~MpscQueue()
+    {
+        T value;
+        while (pop(value));
+        delete _tail;
+    }
+
+    void push(T value)
+    {
+        auto node = new Node;
+        node->value = std::move(value);
+        auto previous = _head.exchange(node, std::memory_order_acq_rel);
+        previous->next.store(node, std::memory_order_release);
+    }
+
+    // Consumer only
+    bool pop(T &value)
+    {
+        auto next = _tail->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+        value = std::move(next->value);
+        delete _tail;
+        _tail = next;
+        return true;
+    }
+};
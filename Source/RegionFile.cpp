@@ -0,0 +1,258 @@
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "RegionFile.hpp"
+#include "GL/Misc.hpp"
+
+
+RegionFile::RegionFile(const std::filesystem::path &path)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return;
+        throw GL::Error("Cannot open region file {}: {}", path.string(), std::strerror(errno));
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) < 0) {
+        ::close(fd);
+        throw GL::Error("Cannot stat region file {}: {}", path.string(), std::strerror(errno));
+    }
+    _size = status.st_size;
+    if (_size < HEADER_SIZE) {
+        ::close(fd);
+        throw GL::Error("Region file {} is truncated", path.string());
+    }
+    auto data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file alive on its own
+    ::close(fd);
+    if (data == MAP_FAILED)
+        throw GL::Error("Cannot map region file {}: {}", path.string(), std::strerror(errno));
+    // Chunks are read in whatever order the camera needs them, read-ahead would mostly fetch unneeded records
+    madvise(data, _size, MADV_RANDOM);
+    _data = static_cast<const std::byte *>(data);
+
+    std::uint32_t header[3];
+    std::memcpy(header, _data, sizeof(header));
+    if (header[0] != MAGIC || header[1] != VERSION) {
+        _unmap();
+        throw GL::Error("{} is not a region file of version {}", path.string(), VERSION);
+    }
+    if (header[2] != LAYOUT) {
+        _unmap();
+        throw GL::Error("Region file {} was written with a different chunk layout", path.string());
+    }
+}
+
+RegionFile::RegionFile(RegionFile &&other) noexcept :
+    _data(other._data),
+    _size(other._size)
+{
+    other._data = nullptr;
+    other._size = 0;
+}
+
+RegionFile &RegionFile::operator=(RegionFile &&other) noexcept
+{
+    if (this != &other) {
+        _unmap();
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+    }
+    return *this;
+}
+
+RegionFile::~RegionFile()
+{
+    _unmap();
+}
+
+void RegionFile::_unmap() noexcept
+{
+    if (_data)
+        munmap(const_cast<std::byte *>(_data), _size);
+    _data = nullptr;
+    _size = 0;
+}
+
+RegionFile::Entry RegionFile::_entry(unsigned index) const noexcept
+{
+    Entry entry;
+    std::memcpy(&entry, _data + 4 * sizeof(std::uint32_t) + index * sizeof(Entry), sizeof(Entry));
+    return entry;
+}
+
+std::span<const std::byte> RegionFile::record(unsigned index) const noexcept
+{
+    if (!_data)
+        return {};
+    const auto entry = _entry(index);
+    if (!entry.size || entry.offset < HEADER_SIZE || std::size_t(entry.offset) + entry.size > _size)
+        return {};
+    return {_data + entry.offset, entry.size};
+}
+
+void RegionFile::Write(const std::filesystem::path &path,
+                       const std::map<unsigned, std::span<const std::byte>> &records)
+{
+    std::vector<Entry> table(CHUNKS, Entry{0, 0});
+    std::size_t offset = HEADER_SIZE;
+    for (const auto &[index, record]: records) {
+        // Records start on 8 byte boundaries, so packed indices stay aligned in the mapping
+        offset = (offset + 7) / 8 * 8;
+        if (offset + record.size() > UINT32_MAX)
+            throw GL::Error("Region file {} would exceed 4 GiB", path.string());
+        table[index] = {static_cast<std::uint32_t>(offset), static_cast<std::uint32_t>(record.size())};
+        offset += record.size();
+    }
+
+    auto temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        const std::uint32_t header[4] = {MAGIC, VERSION, LAYOUT, 0};
+        file.write(reinterpret_cast<const char *>(header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(Entry));
+        std::size_t position = HEADER_SIZE;
+        for (const auto &[index, record]: records) {
+            constexpr char PADDING[8] = {};
+            file.write(PADDING, table[index].offset - position);
+            file.write(reinterpret_cast<const char *>(record.data()), record.size());
+            position = table[index].offset + record.size();
+        }
+        if (!file)
+            throw GL::Error("Cannot write region file {}", temporary.string());
+    }
+    // Existing mappings of the old file stay valid after it is replaced
+    std::filesystem::rename(temporary, path);
+}
+
+
+WorldStorage::WorldStorage(std::filesystem::path directory) :
+    _directory(std::move(directory))
+{
+    std::filesystem::create_directories(_directory);
+}
+
+std::filesystem::path WorldStorage::_region_path(glm::ivec3 region_pos) const
+{
+    return _directory / fmt::format("r.{}.{}.{}.region", region_pos.x, region_pos.y, region_pos.z);
+}
+
+WorldStorage::Region &WorldStorage::_region(glm::ivec3 region_pos)
+{
+    auto &region = _regions[region_pos];
+    if (!region.opened) {
+        region.file = RegionFile(_region_path(region_pos));
+        region.opened = true;
+    }
+    return region;
+}
+
+bool WorldStorage::load(glm::ivec3 chunk_pos, VoxelGrid::Chunk &chunk)
+{
+    auto &region = _region(RegionFile::RegionOf(chunk_pos));
+    const auto index = RegionFile::Index(chunk_pos);
+    std::span<const std::byte> record;
+    if (auto it = region.saved.find(index); it != region.saved.end())
+        record = it->second;
+    else
+        record = region.file.record(index);
+    if (record.empty())
+        return false;
+    if (!chunk.deserialize(record))
+        throw GL::Error("Corrupted record of chunk ({}, {}, {})", chunk_pos.x, chunk_pos.y, chunk_pos.z);
+    return true;
+}
+
+void WorldStorage::save(glm::ivec3 chunk_pos, const VoxelGrid::Chunk &chunk)
+{
+    const auto region_pos = RegionFile::RegionOf(chunk_pos);
+    auto &region = _region(region_pos);
+    auto &record = region.saved[RegionFile::Index(chunk_pos)];
+    // Palette entries of blocks no longer present in the chunk would only widen the stored indices. An air chunk
+    // compacts to a uniform palette, whose record is never empty.
+    auto compacted = chunk;
+    compacted.compact();
+    region.pending_bytes -= record.size();
+    _pending_bytes -= record.size();
+    record.resize(compacted.serialized_size());
+    compacted.serialize(record.data());
+    region.pending_bytes += record.size();
+    _pending_bytes += record.size();
+    // Chunks evicted by streaming would otherwise pile up here until the world is closed. Only this region is
+    // rewritten, since save() runs in the middle of a frame.
+    if (region.pending_bytes >= FLUSH_THRESHOLD)
+        _flush_region(region_pos, region);
+}
+
+void WorldStorage::_flush_region(glm::ivec3 region_pos, Region &region)
+{
+    if (region.saved.empty())
+        return;
+    std::map<unsigned, std::span<const std::byte>> records;
+    for (unsigned index = 0; index < RegionFile::CHUNKS; ++index) {
+        auto it = region.saved.find(index);
+        auto record = it != region.saved.end() ? std::span<const std::byte>(it->second) : region.file.record(index);
+        if (!record.empty())
+            records.emplace(index, record);
+    }
+    const auto path = _region_path(region_pos);
+    RegionFile::Write(path, records);
+    region.saved.clear();
+    region.file = RegionFile(path);
+    _pending_bytes -= region.pending_bytes;
+    region.pending_bytes = 0;
+}
+
+void WorldStorage::flush()
+{
+    _regions.for_each([this](glm::ivec3 region_pos, Region &region) {
+        _flush_region(region_pos, region);
+    });
+}
+
+void WorldStorage::evict(glm::ivec3 center_chunk, int radius)
+{
+    std::vector<glm::ivec3> evicted;
+    _regions.for_each([&](glm::ivec3 region_pos, Region &) {
+        // Distance to the nearest chunk of the region
+        const auto first = region_pos * RegionFile::SIZE;
+        const auto d = glm::clamp(center_chunk, first, first + (RegionFile::SIZE - 1)) - center_chunk;
+        if (d.x * d.x + d.y * d.y + d.z * d.z > radius * radius)
+            evicted.push_back(region_pos);
+    });
+    // Streaming saves nothing into these regions until the window comes back, so their records are written now
+    // rather than held until the world is closed
+    for (const auto region_pos: evicted) {
+        _flush_region(region_pos, *_regions.find(region_pos));
+        _regions.erase(region_pos);
+    }
+}
+
+void WorldStorage::load_grid(VoxelGrid &grid)
+{
+    std::vector<glm::ivec3> positions;
+    grid.for_each_chunk([&](glm::ivec3 chunk_pos, const VoxelGrid::Chunk &) {
+        positions.push_back(chunk_pos);
+    });
+    auto batch = grid.edit_batch();
+    for (const auto chunk_pos: positions) {
+        VoxelGrid::Chunk chunk;
+        if (load(chunk_pos, chunk))
+            grid.put_chunk(chunk_pos, std::move(chunk));
+    }
+}
+
+void WorldStorage::save_grid(const VoxelGrid &grid)
+{
+    grid.for_each_chunk([this](glm::ivec3 chunk_pos, const VoxelGrid::Chunk &chunk) {
+        save(chunk_pos, chunk);
+    });
+    flush();
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <span>
+#include <vector>
+#include "ChunkMap.hpp"
+#include "VoxelGrid.hpp"
+
+
+// Read-only view of a region file holding up to 32x32x32 chunks. The file starts with a short header and a table with
+// offset and size of every chunk record (zero size for missing chunks), followed by the serialized chunks. The file is
+// memory-mapped, so opening it costs no reads and chunks are decoded straight from the page cache.
+class RegionFile
+{
+public:
+    static constexpr int SIZE_LOG2 = 5;
+    static constexpr int SIZE = 1 << SIZE_LOG2;
+    static constexpr int CHUNKS = SIZE * SIZE * SIZE;
+
+    struct Entry
+    {
+        std::uint32_t offset;
+        std::uint32_t size;
+    };
+
+    static constexpr std::uint32_t MAGIC = 0x4e475259;  // "YRGN"
+    static constexpr std::uint32_t VERSION = 2;
+    // Packed indices are stored in the order of the chunk layout the file was written with
+    static constexpr std::uint32_t LAYOUT = VoxelGrid::Chunk::Layout::ID;
+    static constexpr std::size_t HEADER_SIZE = 4 * sizeof(std::uint32_t) + CHUNKS * sizeof(Entry);
+
+private:
+    const std::byte *_data = nullptr;
+    std::size_t _size = 0;
+
+    Entry _entry(unsigned index) const noexcept;
+    void _unmap() noexcept;
+
+public:
+    RegionFile() = default;
+    // A missing file opens as an empty region
+    explicit RegionFile(const std::filesystem::path &path);
+    RegionFile(const RegionFile &other) = delete;
+    RegionFile(RegionFile &&other) noexcept;
+    RegionFile &operator=(RegionFile &&other) noexcept;
+    ~RegionFile();
+
+    // Index of a chunk within its region
+    static unsigned Index(glm::ivec3 chunk_pos) noexcept
+    { return ((chunk_pos.x & (SIZE - 1)) * SIZE + (chunk_pos.y & (SIZE - 1))) * SIZE + (chunk_pos.z & (SIZE - 1)); }
+
+    static glm::ivec3 RegionOf(glm::ivec3 chunk_pos) noexcept
+    { return {chunk_pos.x >> SIZE_LOG2, chunk_pos.y >> SIZE_LOG2, chunk_pos.z >> SIZE_LOG2}; }
+
+    // Serialized chunk at index, empty if the region has no such chunk
+    std::span<const std::byte> record(unsigned index) const noexcept;
+
+    // Writes a region file with the given records (indexed by chunk index) atomically replacing the old one
+    static void Write(const std::filesystem::path &path, const std::map<unsigned, std::span<const std::byte>> &records);
+};
+
+
+// Directory of region files used as a backing store for the chunks of a VoxelGrid. Saved chunks are kept in memory
+// until flush() rewrites the region files they belong to. save() rewrites a single region by itself once
+// FLUSH_THRESHOLD bytes of its records are waiting, and evict() writes out and closes regions the streaming window
+// has left.
+class WorldStorage
+{
+    struct Region
+    {
+        RegionFile file;
+        bool opened = false;
+        // Records saved since the last flush and their total size
+        std::map<unsigned, std::vector<std::byte>> saved;
+        std::size_t pending_bytes = 0;
+    };
+
+    std::filesystem::path _directory;
+    ChunkMap<Region> _regions;
+    // Total size of the saved records of all regions
+    std::size_t _pending_bytes = 0;
+
+    std::filesystem::path _region_path(glm::ivec3 region_pos) const;
+    Region &_region(glm::ivec3 region_pos);
+    void _flush_region(glm::ivec3 region_pos, Region &region);
+
+public:
+    // Per region
+    static constexpr std::size_t FLUSH_THRESHOLD = 4 << 20;
+
+    explicit WorldStorage(std::filesystem::path directory);
+    WorldStorage(const WorldStorage &other) = delete;
+
+    // Returns false, leaving the chunk untouched, if no record of it exists
+    bool load(glm::ivec3 chunk_pos, VoxelGrid::Chunk &chunk);
+    // Chunks of air are stored as well, so that they do not come back as generated terrain
+    void save(glm::ivec3 chunk_pos, const VoxelGrid::Chunk &chunk);
+    void flush();
+    // Closes the regions without a chunk within radius of the center chunk, writing their saved records first
+    void evict(glm::ivec3 center_chunk, int radius);
+
+    std::size_t pending_bytes() const noexcept
+    { return _pending_bytes; }
+
+    void load_grid(VoxelGrid &grid);
+    void save_grid(const VoxelGrid &grid);
+};
@@ -0,0 +1,78 @@
+#include <algorithm>
+#include "SpriteBatch.hpp"
+#include "GL/Debug.hpp"
+
+
+SpriteBatch::~SpriteBatch()
+{
+    release();
+}
+
+void SpriteBatch::add(GLuint texture, glm::vec2 lo, glm::vec2 hi, glm::vec2 tex_lo, glm::vec2 tex_hi)
+{
+    _sprites.push_back({texture, lo, hi, tex_lo, tex_hi});
+}
+
+void SpriteBatch::flush(GL::ShaderProgram &shader)
+{
+    _draw_calls = 0;
+    if (_sprites.empty())
+        return;
+    GL::DebugScope scope("SpriteBatch::flush");
+    // Only sprites sharing a texture keep the order they were added in relative to each other
+    std::stable_sort(_sprites.begin(), _sprites.end(), [](const Sprite &a, const Sprite &b) {
+        return a.texture < b.texture;
+    });
+
+    _vertices.clear();
+    for (const auto &sprite: _sprites) {
+        const Vertex lo_lo{sprite.lo, sprite.tex_lo};
+        const Vertex hi_lo{{sprite.hi.x, sprite.lo.y}, {sprite.tex_hi.x, sprite.tex_lo.y}};
+        const Vertex lo_hi{{sprite.lo.x, sprite.hi.y}, {sprite.tex_lo.x, sprite.tex_hi.y}};
+        const Vertex hi_hi{sprite.hi, sprite.tex_hi};
+        for (const auto &vertex: {lo_lo, hi_lo, lo_hi, lo_hi, hi_lo, hi_hi})
+            _vertices.push_back(vertex);
+    }
+
+    if (!_vao) {
+        glGenVertexArrays(1, &_vao);
+        GL::State::Current().bind_vertex_array(_vao);
+        glGenBuffers(1, &_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, tex_coord));
+        glEnableVertexAttribArray(1);
+    } else {
+        GL::State::Current().bind_vertex_array(_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+    }
+    // Respecifying the storage orphans the data of the previous frame instead of waiting for its draws to finish
+    _capacity = std::max(_capacity, _vertices.size());
+    glBufferData(GL_ARRAY_BUFFER, _capacity * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, _vertices.size() * sizeof(Vertex), _vertices.data());
+
+    shader["ui_canvas"] = 0;
+    for (std::size_t first = 0; first < _sprites.size();) {
+        auto last = first + 1;
+        while (last < _sprites.size() && _sprites[last].texture == _sprites[first].texture)
+            ++last;
+        GL::State::Current().bind_texture(0, GL_TEXTURE_2D, _sprites[first].texture);
+        glDrawArrays(GL_TRIANGLES, static_cast<GLint>(6 * first), static_cast<GLsizei>(6 * (last - first)));
+        ++_draw_calls;
+        first = last;
+    }
+    GL::GLError::RaiseIfError();
+    _sprites.clear();
+}
+
+void SpriteBatch::release() noexcept
+{
+    if (_vao) {
+        glDeleteBuffers(1, &_vbo);
+        GL::State::Current().forget_vertex_array(_vao);
+        glDeleteVertexArrays(1, &_vao);
+        _vao = _vbo = 0;
+    }
+    _capacity = 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include <glm/vec2.hpp>
+#include "GL/Shaders.hpp"
+
+
+// Textured screen quads collected during a frame and drawn from one stream buffer, with a single draw call for every
+// run of sprites sharing a texture. Coordinates are normalized device coordinates before UI.vert divides x by the
+// screen ratio.
+class SpriteBatch
+{
+public:
+    struct Vertex
+    {
+        glm::vec2 position;
+        glm::vec2 tex_coord;
+    };
+
+private:
+    struct Sprite
+    {
+        GLuint texture;
+        glm::vec2 lo, hi;
+        glm::vec2 tex_lo, tex_hi;
+    };
+
+    std::vector<Sprite> _sprites;
+    std::vector<Vertex> _vertices;
+    GLuint _vao = 0, _vbo = 0;
+    // Vertices the buffer has room for
+    std::size_t _capacity = 0;
+    unsigned _draw_calls = 0;
+
+public:
+    SpriteBatch() = default;
+    SpriteBatch(const SpriteBatch &other) = delete;
+    ~SpriteBatch();
+
+    void add(GLuint texture, glm::vec2 lo, glm::vec2 hi, glm::vec2 tex_lo = {0, 0}, glm::vec2 tex_hi = {1, 1});
+    // Draws and forgets the sprites added since the last flush; shader must be in use
+    void flush(GL::ShaderProgram &shader);
+    void release() noexcept;
+
+    unsigned draw_calls() const noexcept
+    { return _draw_calls; }
+};
@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <cstring>
 #include <glm/geometric.hpp>
 #include <limits>
 #include "VoxelGrid.hpp"
@@ -6,19 +9,430 @@
 
 namespace {
 
-template<class Float>
-constexpr Float UntilGridHit(Float origin, Float speed, Float min_speed=0.00001)
+constexpr float RAYCAST_MAX_DISTANCE = 32.0;
+constexpr int RAY_LANES = 8;
+
+// Face of the entered voxel crossed when stepping along the axis in negative / positive direction
+constexpr VoxelFace ENTERED_FACE[3][2] = {
+    {VoxelFace::RIGHT, VoxelFace::LEFT},
+    {VoxelFace::TOP, VoxelFace::BOTTOM},
+    {VoxelFace::FRONT, VoxelFace::BACK},
+};
+
+// Amanatides-Woo setup along one axis: direction of steps, ray length between two voxel boundaries and ray length
+// until the first boundary is crossed
+void SetupAxis(float origin, float direction, int voxel, int &step, float &t_delta, float &t_max)
+{
+    constexpr auto INF = std::numeric_limits<float>::infinity();
+    if (direction > 0) {
+        step = 1;
+        t_delta = 1.0f / direction;
+        t_max = (static_cast<float>(voxel) + 1.0f - origin) * t_delta;
+    } else if (direction < 0) {
+        step = -1;
+        t_delta = -1.0f / direction;
+        t_max = (origin - static_cast<float>(voxel)) * t_delta;
+    } else {
+        step = 0;
+        t_delta = INF;
+        t_max = INF;
+    }
+}
+
+}
+
+bool VoxelGrid::Chunk::set(unsigned x, unsigned y, unsigned z, Voxel voxel)
+{
+    if (!_bits) {
+        if (voxel.block_id == _single.block_id)
+            return false;
+        _make_paletted();
+    }
+
+    const auto offset = _offset(x, y, z);
+    const auto old_index = _get_index(offset);
+    const auto old_voxel = _palette[old_index];
+    if (old_voxel.block_id == voxel.block_id)
+        return false;
+    const auto index = _palette_slot(voxel);
+    --_counts[old_index];
+    ++_counts[index];
+    _put_index(offset, index);
+    _update_occupancy(x, y, z, old_voxel.block_id != 0, voxel.block_id != 0);
+    if (_counts[index] == VOLUME)
+        fill(voxel);
+    return true;
+}
+
+void VoxelGrid::Chunk::fill(Voxel voxel)
+{
+    _palette = std::vector<Voxel>();
+    _counts = std::vector<std::uint16_t>();
+    _indices = std::vector<std::uint64_t>();
+    _bits = 0;
+    _single = voxel;
+    _solid_count = voxel.block_id ? VOLUME : 0;
+    _brick_mask = voxel.block_id ? ~std::uint64_t(0) : 0;
+}
+
+void VoxelGrid::Chunk::compact()
+{
+    if (!_bits)
+        return;
+
+    std::vector<unsigned> remap(_palette.size());
+    std::vector<Voxel> palette;
+    std::vector<std::uint16_t> counts;
+    for (unsigned i = 0; i < _palette.size(); ++i) {
+        if (!_counts[i])
+            continue;
+        remap[i] = palette.size();
+        palette.push_back(_palette[i]);
+        counts.push_back(_counts[i]);
+    }
+    if (palette.size() == 1) {
+        fill(palette[0]);
+        return;
+    }
+
+    unsigned bits = 1;
+    while ((1u << bits) < palette.size())
+        bits *= 2;
+    std::vector<std::uint64_t> indices(VOLUME * bits / 64, 0);
+    for (unsigned offset = 0; offset < VOLUME; ++offset) {
+        const auto bit = offset * bits;
+        indices[bit / 64] |= static_cast<std::uint64_t>(remap[_get_index(offset)]) << (bit % 64);
+    }
+    _palette = std::move(palette);
+    _counts = std::move(counts);
+    _indices = std::move(indices);
+    _bits = bits;
+}
+
+bool VoxelGrid::Chunk::fill_box(glm::ivec3 lo, glm::ivec3 hi, Voxel voxel)
+{
+    if (!_bits && _single.block_id == voxel.block_id)
+        return false;
+    if (_whole(lo, hi)) {
+        fill(voxel);
+        return true;
+    }
+
+    if (!_bits)
+        _make_paletted();
+    const auto index = _palette_slot(voxel);
+    bool changed = false;
+    for (int x = lo.x; x <= hi.x; ++x) {
+        for (int y = lo.y; y <= hi.y; ++y) {
+            if constexpr (Layout::CONTIGUOUS_ROWS) {
+                changed |= _fill_run(_offset(x, y, lo.z), hi.z - lo.z + 1, index);
+            } else {
+                for (int z = lo.z; z <= hi.z; ++z)
+                    changed |= _fill_run(_offset(x, y, z), 1, index);
+            }
+        }
+    }
+    _refresh_bricks(lo, hi);
+    if (_counts[index] == VOLUME)
+        fill(voxel);
+    return changed;
+}
+
+bool VoxelGrid::Chunk::replace_in_box(glm::ivec3 lo, glm::ivec3 hi, Voxel from, Voxel to)
+{
+    if (from.block_id == to.block_id)
+        return false;
+    if (!_bits)
+        return _single.block_id == from.block_id && fill_box(lo, hi, to);
+
+    unsigned from_index = _palette.size(), to_index = _palette.size();
+    for (unsigned i = 0; i < _palette.size(); ++i) {
+        if (_counts[i] && _palette[i].block_id == from.block_id)
+            from_index = i;
+        if (_counts[i] && _palette[i].block_id == to.block_id)
+            to_index = i;
+    }
+    if (from_index == _palette.size())
+        return false;
+
+    // Over the whole chunk a block missing from the palette is replaced by rewriting just its palette entry
+    if (_whole(lo, hi) && to_index == _palette.size()) {
+        if (from.block_id == 0)
+            _solid_count += _counts[from_index];
+        else if (to.block_id == 0)
+            _solid_count -= _counts[from_index];
+        _palette[from_index] = to;
+        _refresh_bricks(lo, hi);
+        return true;
+    }
+
+    to_index = _palette_slot(to);
+    unsigned replaced = 0;
+    for (int x = lo.x; x <= hi.x; ++x) {
+        for (int y = lo.y; y <= hi.y; ++y) {
+            for (int z = lo.z; z <= hi.z; ++z) {
+                const auto offset = _offset(x, y, z);
+                if (_get_index(offset) == from_index) {
+                    _put_index(offset, to_index);
+                    ++replaced;
+                }
+            }
+        }
+    }
+    _counts[from_index] -= replaced;
+    _counts[to_index] += replaced;
+    if (from.block_id == 0)
+        _solid_count += replaced;
+    else if (to.block_id == 0)
+        _solid_count -= replaced;
+    _refresh_bricks(lo, hi);
+    if (_counts[to_index] == VOLUME)
+        fill(to);
+    return replaced > 0;
+}
+
+bool VoxelGrid::Chunk::copy_box(const Chunk &source, glm::ivec3 source_lo, glm::ivec3 lo, glm::ivec3 hi)
 {
-    if (std::abs(speed) < min_speed)
-        return std::numeric_limits<Float>::infinity();
-    if (speed > 0) {
-        return (std::ceil(origin) - origin) / speed;
+    if (!source._bits)
+        return fill_box(lo, hi, source._single);
+    if (_whole(lo, hi) && source_lo == glm::ivec3(0)) {
+        *this = source;
+        return true;
+    }
+
+    if (!_bits)
+        _make_paletted();
+    // Palette indices of the source translated to ours on first use
+    std::vector<int> remap(source._palette.size(), -1);
+    bool changed = false;
+    const auto shift = source_lo - lo;
+    for (int x = lo.x; x <= hi.x; ++x) {
+        for (int y = lo.y; y <= hi.y; ++y) {
+            for (int z = lo.z; z <= hi.z; ++z) {
+                const auto offset = _offset(x, y, z);
+                const auto source_index = source._get_index(_offset(x + shift.x, y + shift.y, z + shift.z));
+                if (remap[source_index] < 0)
+                    remap[source_index] = _palette_slot(source._palette[source_index]);
+                const auto index = static_cast<unsigned>(remap[source_index]);
+                const auto old_index = _get_index(offset);
+                if (old_index == index)
+                    continue;
+                _put_index(offset, index);
+                --_counts[old_index];
+                ++_counts[index];
+                if ((_palette[old_index].block_id != 0) != (_palette[index].block_id != 0))
+                    _palette[index].block_id ? ++_solid_count : --_solid_count;
+                changed = true;
+            }
+        }
     }
-    return (origin - std::floor(origin)) / -speed;
+    _refresh_bricks(lo, hi);
+    if (std::find(_counts.begin(), _counts.end(), VOLUME) != _counts.end())
+        compact();
+    return changed;
 }
 
+std::size_t VoxelGrid::Chunk::memory_usage() const noexcept
+{
+    return sizeof(Chunk) + _palette.capacity() * sizeof(Voxel) + _counts.capacity() * sizeof(std::uint16_t)
+        + _indices.capacity() * sizeof(std::uint64_t);
+}
+
+std::size_t VoxelGrid::Chunk::serialized_size() const noexcept
+{
+    const std::size_t palette_size = _bits ? _palette.size() : 1;
+    return 2 * sizeof(std::uint32_t) + (palette_size * sizeof(std::uint32_t) + 7) / 8 * 8
+        + _indices.size() * sizeof(std::uint64_t);
+}
+
+void VoxelGrid::Chunk::serialize(std::byte *out) const
+{
+    const std::uint32_t header[2] = {_bits, _bits ? static_cast<std::uint32_t>(_palette.size()) : 1u};
+    std::memcpy(out, header, sizeof(header));
+    out += sizeof(header);
+    const auto palette_bytes = (header[1] * sizeof(std::uint32_t) + 7) / 8 * 8;
+    std::memset(out, 0, palette_bytes);
+    for (std::uint32_t i = 0; i < header[1]; ++i) {
+        const std::uint32_t block_id = _bits ? _palette[i].block_id : _single.block_id;
+        std::memcpy(out + i * sizeof(block_id), &block_id, sizeof(block_id));
+    }
+    out += palette_bytes;
+    if (_bits)
+        std::memcpy(out, _indices.data(), _indices.size() * sizeof(std::uint64_t));
+}
+
+bool VoxelGrid::Chunk::deserialize(std::span<const std::byte> data)
+{
+    fill({0});
+    std::uint32_t header[2];
+    if (data.size() < sizeof(header))
+        return false;
+    std::memcpy(header, data.data(), sizeof(header));
+    const auto [bits, palette_size] = header;
+    if (bits != 0 && bits != 1 && bits != 2 && bits != 4 && bits != 8 && bits != 16)
+        return false;
+    if (palette_size == 0 || palette_size > (1u << bits))
+        return false;
+    const auto palette_bytes = (palette_size * sizeof(std::uint32_t) + 7) / 8 * 8;
+    const std::size_t index_words = VOLUME * bits / 64;
+    if (data.size() != sizeof(header) + palette_bytes + index_words * sizeof(std::uint64_t))
+        return false;
+
+    std::vector<Voxel> palette(palette_size);
+    const auto palette_data = data.data() + sizeof(header);
+    for (std::uint32_t i = 0; i < palette_size; ++i) {
+        std::uint32_t block_id;
+        std::memcpy(&block_id, palette_data + i * sizeof(block_id), sizeof(block_id));
+        palette[i] = {block_id};
+    }
+    if (!bits) {
+        fill(palette[0]);
+        return true;
+    }
+
+    // Counts and occupancy are not stored, rebuilding them also checks every index
+    _indices.resize(index_words);
+    std::memcpy(_indices.data(), palette_data + palette_bytes, index_words * sizeof(std::uint64_t));
+    _bits = bits;
+    std::vector<std::uint16_t> counts(palette_size, 0);
+    for (unsigned x = 0; x < SIZE; ++x) {
+        for (unsigned y = 0; y < SIZE; ++y) {
+            for (unsigned z = 0; z < SIZE; ++z) {
+                const auto index = _get_index(_offset(x, y, z));
+                if (index >= palette_size) {
+                    fill({0});
+                    return false;
+                }
+                ++counts[index];
+                if (palette[index].block_id) {
+                    ++_solid_count;
+                    _brick_mask |= std::uint64_t(1) << _brick(x, y, z);
+                }
+            }
+        }
+    }
+    _palette = std::move(palette);
+    _counts = std::move(counts);
+    if (std::find(_counts.begin(), _counts.end(), 0) != _counts.end() || _palette.size() == 1)
+        compact();
+    return true;
+}
+
+unsigned VoxelGrid::Chunk::_palette_slot(Voxel voxel)
+{
+    // Entries whose count dropped to zero are reused before the palette grows
+    unsigned free_slot = _palette.size();
+    for (unsigned i = 0; i < _palette.size(); ++i) {
+        if (_counts[i] && _palette[i].block_id == voxel.block_id)
+            return i;
+        if (!_counts[i] && free_slot == _palette.size())
+            free_slot = i;
+    }
+    if (free_slot < _palette.size()) {
+        _palette[free_slot] = voxel;
+        return free_slot;
+    }
+
+    if (_palette.size() == (1u << _bits))
+        _repack(_bits * 2);
+    _palette.push_back(voxel);
+    _counts.push_back(0);
+    return free_slot;
+}
+
+void VoxelGrid::Chunk::_make_paletted()
+{
+    _palette = {_single};
+    _counts = {VOLUME};
+    _indices.assign(VOLUME / 64, 0);
+    _bits = 1;
+}
+
+bool VoxelGrid::Chunk::_fill_run(unsigned offset, unsigned length, unsigned index)
+{
+    const auto field = (std::uint64_t(1) << _bits) - 1;
+    // The index repeated in every field of a word
+    const auto pattern = index * (~std::uint64_t(0) / field);
+    const bool solid = _palette[index].block_id != 0;
+    bool changed = false;
+    for (auto bit = offset * _bits, end = (offset + length) * _bits; bit < end;) {
+        const auto shift = bit % 64;
+        const auto width = std::min(64 - shift, end - bit);
+        const auto mask = (width == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << width) - 1) << shift;
+        auto &word = _indices[bit / 64];
+        auto old = (word & mask) >> shift;
+        for (unsigned n = width / _bits; n--; old >>= _bits) {
+            const auto old_index = static_cast<unsigned>(old & field);
+            if (old_index == index)
+                continue;
+            --_counts[old_index];
+            ++_counts[index];
+            if ((_palette[old_index].block_id != 0) != solid)
+                solid ? ++_solid_count : --_solid_count;
+            changed = true;
+        }
+        word = (word & ~mask) | (pattern & mask);
+        bit += width;
+    }
+    return changed;
+}
+
+void VoxelGrid::Chunk::_refresh_bricks(glm::ivec3 lo, glm::ivec3 hi)
+{
+    for (int bx = lo.x >> BRICK_SIZE_LOG2; bx <= hi.x >> BRICK_SIZE_LOG2; ++bx) {
+        for (int by = lo.y >> BRICK_SIZE_LOG2; by <= hi.y >> BRICK_SIZE_LOG2; ++by) {
+            for (int bz = lo.z >> BRICK_SIZE_LOG2; bz <= hi.z >> BRICK_SIZE_LOG2; ++bz) {
+                const unsigned x0 = bx * BRICK_SIZE, y0 = by * BRICK_SIZE, z0 = bz * BRICK_SIZE;
+                bool occupied = false;
+                for (unsigned x = x0; x < x0 + BRICK_SIZE && !occupied; ++x) {
+                    for (unsigned y = y0; y < y0 + BRICK_SIZE && !occupied; ++y) {
+                        for (unsigned z = z0; z < z0 + BRICK_SIZE && !occupied; ++z)
+                            occupied = (*this)(x, y, z).block_id != 0;
+                    }
+                }
+                const auto brick_bit = std::uint64_t(1) << _brick(x0, y0, z0);
+                _brick_mask = occupied ? _brick_mask | brick_bit : _brick_mask & ~brick_bit;
+            }
+        }
+    }
+}
+
+void VoxelGrid::Chunk::_update_occupancy(unsigned x, unsigned y, unsigned z, bool was_solid, bool is_solid)
+{
+    if (was_solid == is_solid)
+        return;
+    const auto brick_bit = std::uint64_t(1) << _brick(x, y, z);
+    if (is_solid) {
+        ++_solid_count;
+        _brick_mask |= brick_bit;
+        return;
+    }
+
+    --_solid_count;
+    const unsigned x0 = x & ~(BRICK_SIZE - 1), y0 = y & ~(BRICK_SIZE - 1), z0 = z & ~(BRICK_SIZE - 1);
+    for (unsigned bx = x0; bx < x0 + BRICK_SIZE; ++bx) {
+        for (unsigned by = y0; by < y0 + BRICK_SIZE; ++by) {
+            for (unsigned bz = z0; bz < z0 + BRICK_SIZE; ++bz) {
+                if ((*this)(bx, by, bz).block_id != 0)
+                    return;
+            }
+        }
+    }
+    _brick_mask &= ~brick_bit;
 }
 
+void VoxelGrid::Chunk::_repack(unsigned bits)
+{
+    std::vector<std::uint64_t> indices(VOLUME * bits / 64, 0);
+    for (unsigned offset = 0; offset < VOLUME; ++offset) {
+        const auto bit = offset * bits;
+        indices[bit / 64] |= static_cast<std::uint64_t>(_get_index(offset)) << (bit % 64);
+    }
+    _indices = std::move(indices);
+    _bits = bits;
+}
+
+
 VoxelGrid::VoxelGrid(unsigned int width, unsigned int height, unsigned int depth, int x0, int y0, int z0) :
     _x0(x0), _y0(y0), _z0(z0)
 {
@@ -28,6 +442,230 @@ VoxelGrid::VoxelGrid(unsigned int width, unsigned int height, unsigned int depth
     _chunks.resize(_x_chunks * _y_chunks * _z_chunks);
 }
 
+VoxelGrid VoxelGrid::Unbounded()
+{
+    VoxelGrid grid;
+    grid._bounded = false;
+    return grid;
+}
+
+void VoxelGrid::stream(glm::vec3 center, int view_radius)
+{
+    if (_bounded)
+        return;
+    const auto center_chunk = chunk_of(static_cast<int>(std::floor(center.x)), static_cast<int>(std::floor(center.y)),
+                                       static_cast<int>(std::floor(center.z)));
+    if (_streamed && center_chunk == _stream_center && view_radius == _stream_radius)
+        return;
+    _streamed = true;
+    _stream_center = center_chunk;
+    _stream_radius = view_radius;
+    EditBatch batch(*this);
+
+    const auto in_radius = [&](glm::ivec3 chunk_pos) {
+        const auto d = chunk_pos - center_chunk;
+        return d.x * d.x + d.y * d.y + d.z * d.z <= view_radius * view_radius;
+    };
+
+    std::vector<glm::ivec3> evicted;
+    _chunk_map.for_each([&](glm::ivec3 chunk_pos, const Chunk &) {
+        if (!in_radius(chunk_pos))
+            evicted.push_back(chunk_pos);
+    });
+    for (const auto chunk_pos: evicted) {
+        if (_chunk_unloader)
+            _chunk_unloader(chunk_pos, *_chunk_map.find(chunk_pos));
+        _chunk_map.erase(chunk_pos);
+        _mark_dirty(chunk_pos, nullptr);
+    }
+
+    if (!_chunk_loader)
+        return;
+    for (int x = -view_radius; x <= view_radius; ++x) {
+        for (int y = -view_radius; y <= view_radius; ++y) {
+            for (int z = -view_radius; z <= view_radius; ++z) {
+                const auto chunk_pos = center_chunk + glm::ivec3(x, y, z);
+                if (!in_radius(chunk_pos) || _chunk_map.find(chunk_pos))
+                    continue;
+                _chunk_loader(chunk_pos, _chunk_map[chunk_pos]);
+                _mark_dirty(chunk_pos, nullptr);
+            }
+        }
+    }
+}
+
+void VoxelGrid::put_chunk(glm::ivec3 chunk_pos, Chunk chunk)
+{
+    auto target = _chunk_for_write(chunk_pos);
+    if (!target)
+        return;
+    *target = std::move(chunk);
+    _mark_dirty(chunk_pos, nullptr);
+}
+
+template<class Function>
+void VoxelGrid::_for_each_chunk_in_box(glm::ivec3 lo, glm::ivec3 hi, Function &&function) const
+{
+    lo = glm::max(lo, glm::ivec3(min_x(), min_y(), min_z()));
+    hi = glm::min(hi, glm::ivec3(max_x(), max_y(), max_z()));
+    if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z)
+        return;
+    const auto first = _locate(lo.x, lo.y, lo.z).chunk_pos, last = _locate(hi.x, hi.y, hi.z).chunk_pos;
+    for (int x = first.x; x <= last.x; ++x) {
+        for (int y = first.y; y <= last.y; ++y) {
+            for (int z = first.z; z <= last.z; ++z) {
+                const glm::ivec3 chunk_pos(x, y, z);
+                const auto origin = chunk_origin(chunk_pos);
+                function(chunk_pos, glm::max(lo - origin, glm::ivec3(0)),
+                         glm::min(hi - origin, glm::ivec3(Chunk::SIZE - 1)));
+            }
+        }
+    }
+}
+
+void VoxelGrid::fill_box(glm::ivec3 lo, glm::ivec3 hi, Voxel voxel)
+{
+    EditBatch batch(*this);
+    _for_each_chunk_in_box(lo, hi, [&](glm::ivec3 chunk_pos, glm::ivec3 local_lo, glm::ivec3 local_hi) {
+        if (!_bounded && voxel.block_id == 0 && !find_chunk(chunk_pos))
+            return;
+        auto chunk = _chunk_for_write(chunk_pos);
+        if (chunk && chunk->fill_box(local_lo, local_hi, voxel))
+            _mark_dirty(chunk_pos, nullptr);
+    });
+}
+
+void VoxelGrid::replace_in_box(glm::ivec3 lo, glm::ivec3 hi, Voxel from, Voxel to)
+{
+    EditBatch batch(*this);
+    _for_each_chunk_in_box(lo, hi, [&](glm::ivec3 chunk_pos, glm::ivec3 local_lo, glm::ivec3 local_hi) {
+        // Missing chunks of an unbounded grid are air
+        if (!_bounded && from.block_id != 0 && !find_chunk(chunk_pos))
+            return;
+        auto chunk = _chunk_for_write(chunk_pos);
+        if (chunk && chunk->replace_in_box(local_lo, local_hi, from, to))
+            _mark_dirty(chunk_pos, nullptr);
+    });
+}
+
+void VoxelGrid::_copy_box(const VoxelGrid &source, glm::ivec3 source_lo, VoxelGrid &target, glm::ivec3 target_lo,
+                          glm::ivec3 size)
+{
+    const auto shift = source_lo - target_lo;
+    target._for_each_chunk_in_box(target_lo, target_lo + size - 1,
+                                  [&](glm::ivec3 target_pos, glm::ivec3 lo, glm::ivec3 hi) {
+        // Parts of the source chunks covering this target chunk, in target chunk coordinates
+        const auto target_origin = target.chunk_origin(target_pos);
+        source._for_each_chunk_in_box(target_origin + lo + shift, target_origin + hi + shift,
+                                      [&](glm::ivec3 source_pos, glm::ivec3 part_lo, glm::ivec3 part_hi) {
+            const auto to_target = source.chunk_origin(source_pos) - shift - target_origin;
+            const auto source_chunk = source.find_chunk(source_pos);
+            if (!target._bounded && !source_chunk && !target.find_chunk(target_pos))
+                return;
+            auto chunk = target._chunk_for_write(target_pos);
+            if (!chunk)
+                return;
+            const bool changed = source_chunk
+                ? chunk->copy_box(*source_chunk, part_lo, part_lo + to_target, part_hi + to_target)
+                : chunk->fill_box(part_lo + to_target, part_hi + to_target, {0});
+            if (changed)
+                target._mark_dirty(target_pos, nullptr);
+        });
+    });
+}
+
+VoxelRegion VoxelGrid::copy_region(glm::ivec3 lo, glm::ivec3 hi) const
+{
+    const auto size = glm::max(hi - lo + 1, glm::ivec3(0));
+    VoxelRegion region{size, VoxelGrid(size.x, size.y, size.z)};
+    _copy_box(*this, lo, region.voxels, glm::ivec3(0), size);
+    return region;
+}
+
+void VoxelGrid::paste_region(const VoxelRegion &region, glm::ivec3 lo)
+{
+    EditBatch batch(*this);
+    _copy_box(region.voxels, glm::ivec3(0), *this, lo, region.size);
+}
+
+std::vector<glm::ivec3> VoxelGrid::drain_dirty_chunks()
+{
+    std::vector<glm::ivec3> dirty;
+    dirty.reserve(_dirty.size());
+    _dirty.for_each([&](glm::ivec3 chunk_pos, bool) {
+        dirty.push_back(chunk_pos);
+    });
+    _dirty.clear();
+    return dirty;
+}
+
+void VoxelGrid::_mark_dirty(glm::ivec3 chunk_pos, const unsigned *local)
+{
+    // Voxels on a chunk border also change which faces of the neighbouring chunk are visible
+    auto &dirty = _batch_depth ? _pending_dirty : _dirty;
+    dirty[chunk_pos] = true;
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int d: {-1, 1}) {
+            if (local && local[axis] != (d < 0 ? 0 : Chunk::SIZE - 1))
+                continue;
+            auto neighbour = chunk_pos;
+            neighbour[axis] += d;
+            if (find_chunk(neighbour))
+                dirty[neighbour] = true;
+        }
+    }
+    if (!_batch_depth)
+        ++_generation;
+}
+
+void VoxelGrid::_end_batch()
+{
+    if (--_batch_depth || _pending_dirty.empty())
+        return;
+    _pending_dirty.for_each([&](glm::ivec3 chunk_pos, bool) {
+        _dirty[chunk_pos] = true;
+    });
+    _pending_dirty.clear();
+    ++_generation;
+}
+
+const VoxelGrid::Chunk *VoxelGrid::_chunk_in_slot(std::size_t slot, glm::ivec3 &chunk_pos) const
+{
+    if (!_bounded)
+        return _chunk_map.slot(slot, chunk_pos);
+    chunk_pos = {static_cast<int>(slot / (_y_chunks * _z_chunks)), static_cast<int>(slot / _z_chunks % _y_chunks),
+                 static_cast<int>(slot % _z_chunks)};
+    return &_chunks[slot];
+}
+
+void VoxelGrid::NonEmptyChunkIterator::_skip_empty()
+{
+    glm::ivec3 chunk_pos;
+    while (_index < _grid->_chunk_slots()) {
+        auto chunk = _grid->_chunk_in_slot(_index, chunk_pos);
+        if (chunk && !chunk->empty())
+            return;
+        ++_index;
+    }
+}
+
+VoxelGrid::ChunkEntry VoxelGrid::NonEmptyChunkIterator::operator*() const
+{
+    glm::ivec3 chunk_pos;
+    auto chunk = _grid->_chunk_in_slot(_index, chunk_pos);
+    return {chunk_pos, *chunk};
+}
+
+std::size_t VoxelGrid::memory_usage() const noexcept
+{
+    std::size_t total = sizeof(VoxelGrid) + (_chunks.capacity() - _chunks.size()) * sizeof(Chunk)
+        + (_chunk_map.capacity() - _chunk_map.size()) * sizeof(Chunk);
+    for_each_chunk([&](glm::ivec3, const Chunk &chunk) {
+        total += chunk.memory_usage();
+    });
+    return total;
+}
+
 std::bitset<6> VoxelGrid::faces_visibility(int x, int y, int z)
 {
     std::bitset<6> result;
@@ -40,55 +678,170 @@ std::bitset<6> VoxelGrid::faces_visibility(int x, int y, int z)
     return result;
 }
 
-RaycastResult VoxelGrid::raycast(glm::vec3 o, glm::vec3 r)
+bool VoxelGrid::_trace_voxel(int voxel[3], const int step[3], const float t_delta[3], float t_max[3],
+                             float max_distance) const
+{
+    auto [chunk_pos, dx, dy, dz] = _locate(voxel[0], voxel[1], voxel[2]);
+    auto chunk = find_chunk(chunk_pos);
+    int cell_log2;
+    if (!chunk || chunk->empty())
+        cell_log2 = Chunk::SIZE_LOG2;
+    else if (!chunk->brick_occupied(dx, dy, dz))
+        cell_log2 = Chunk::BRICK_SIZE_LOG2;
+    else
+        return (*chunk)(dx, dy, dz).block_id != 0;
+
+    // The ray leaves the cell at the first boundary crossing past the cell's last voxel along some axis
+    const int origin[3] = {_x0, _y0, _z0};
+    int remaining[3];
+    float t_exit = max_distance;
+    for (int axis = 0; axis < 3; ++axis) {
+        const int cell_min = ((voxel[axis] - origin[axis]) >> cell_log2 << cell_log2) + origin[axis];
+        const int cell_max = cell_min + (1 << cell_log2) - 1;
+        remaining[axis] = step[axis] > 0 ? cell_max - voxel[axis] : voxel[axis] - cell_min;
+        if (step[axis])
+            t_exit = std::min(t_exit, t_max[axis] + static_cast<float>(remaining[axis]) * t_delta[axis]);
+    }
+
+    // Take every crossing before that, which keeps the voxel inside of the cell
+    for (int axis = 0; axis < 3; ++axis) {
+        if (!step[axis] || !(t_max[axis] < t_exit))
+            continue;
+        const auto crossings = std::min(remaining[axis],
+                                        static_cast<int>(std::ceil((t_exit - t_max[axis]) / t_delta[axis])));
+        voxel[axis] += crossings * step[axis];
+        t_max[axis] += static_cast<float>(crossings) * t_delta[axis];
+    }
+    return false;
+}
+
+RaycastResult VoxelGrid::raycast(glm::vec3 o, glm::vec3 r) const
 {
-    constexpr float MAX_D = 32.0;
-    constexpr unsigned MAX_I = 100;
-    constexpr float EPSILON = 0.01;
-//    fmt::print("Raycast ({}, {}, {}) --> [{}. {}. {}]:\n", o.x, o.y, o.z, r.x, r.y, r.z);
     r = glm::normalize(r);
 
     RaycastResult result;
-    result.voxel_x = static_cast<int>(std::floor(o.x));
-    result.voxel_y = static_cast<int>(std::floor(o.y));
-    result.voxel_z = static_cast<int>(std::floor(o.z));
-    result.started_in_bounds  = in_bounds(result.voxel_x, result.voxel_y, result.voxel_z);
-
-    unsigned i = 0;
-    float dist = 0.0;
-    while (dist < MAX_D && i < MAX_I) {
-        ++i;
-        auto d = std::min(UntilGridHit(o.x, r.x), std::min(UntilGridHit(o.y, r.y), UntilGridHit(o.z, r.z))) + EPSILON;
-        dist += d;
-        o += d * r;
-
-        auto x = static_cast<int>(std::floor(o.x));
-        auto y = static_cast<int>(std::floor(o.y));
-        auto z = static_cast<int>(std::floor(o.z));
-//        fmt::print("({}, {}, {}), ", x, y, z);
-
-        if (result.started_in_bounds && !in_bounds(x, y, z))
+    int voxel[3], step[3];
+    float t_delta[3], t_max[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        voxel[axis] = static_cast<int>(std::floor(o[axis]));
+        SetupAxis(o[axis], r[axis], voxel[axis], step[axis], t_delta[axis], t_max[axis]);
+    }
+    result.voxel_x = voxel[0];
+    result.voxel_y = voxel[1];
+    result.voxel_z = voxel[2];
+    result.started_in_bounds = in_bounds(voxel[0], voxel[1], voxel[2]);
+
+    while (true) {
+        const int axis = t_max[0] <= t_max[1] ? (t_max[0] <= t_max[2] ? 0 : 2) : (t_max[1] <= t_max[2] ? 1 : 2);
+        const auto t = t_max[axis];
+        if (!(t < RAYCAST_MAX_DISTANCE))
+            break;
+        voxel[axis] += step[axis];
+        t_max[axis] += t_delta[axis];
+
+        if (result.started_in_bounds && !in_bounds(voxel[0], voxel[1], voxel[2]))
             return result;
-        if (result.voxel_x < x)
-            result.hit_face = VoxelFace::LEFT;
-        else if (result.voxel_x > x)
-            result.hit_face = VoxelFace::RIGHT;
-        else if (result.voxel_y < y)
-            result.hit_face = VoxelFace::BOTTOM;
-        else if (result.voxel_y > y)
-            result.hit_face = VoxelFace::TOP;
-        else if (result.voxel_z < z)
-            result.hit_face = VoxelFace::BACK;
-        else if (result.voxel_z > z)
-            result.hit_face = VoxelFace::FRONT;
-        result.voxel_x = x;
-        result.voxel_y = y;
-        result.voxel_z = z;
-        if (_contains_voxel(x, y, z)) {
-            result.hit = true;
+        result.hit_face = ENTERED_FACE[axis][step[axis] > 0];
+        result.distance = t;
+        result.hit = _trace_voxel(voxel, step, t_delta, t_max, RAYCAST_MAX_DISTANCE);
+        result.voxel_x = voxel[0];
+        result.voxel_y = voxel[1];
+        result.voxel_z = voxel[2];
+        if (result.hit)
             return result;
-        }
     }
 
     return result;
 }
+
+void VoxelGrid::raycast_batch(std::span<const glm::vec3> origins, std::span<const glm::vec3> directions,
+                              std::span<RaycastResult> results) const
+{
+    assert(origins.size() == directions.size() && origins.size() == results.size());
+
+    // Rays are traversed RAY_LANES at a time with their state kept in structure-of-arrays form. Choosing the axis
+    // and advancing the DDA is branch-free over all lanes, so the compiler turns it into SIMD code; only the voxel
+    // lookups and empty space skipping are done lane by lane.
+    int voxel[3][RAY_LANES], step[3][RAY_LANES];
+    float t_delta[3][RAY_LANES], t_max[3][RAY_LANES], t[RAY_LANES];
+    int stepped_axis[RAY_LANES];
+    bool active[RAY_LANES];
+
+    for (std::size_t first = 0; first < origins.size(); first += RAY_LANES) {
+        const auto lanes = static_cast<int>(std::min<std::size_t>(RAY_LANES, origins.size() - first));
+        int active_count = lanes;
+        for (int i = 0; i < RAY_LANES; ++i) {
+            active[i] = i < lanes;
+            if (!active[i]) {
+                // Padding lanes go through the SIMD step as well, so all of their state has to be defined
+                for (int axis = 0; axis < 3; ++axis) {
+                    voxel[axis][i] = 0;
+                    SetupAxis(0, 0, 0, step[axis][i], t_delta[axis][i], t_max[axis][i]);
+                }
+                continue;
+            }
+            const auto o = origins[first + i];
+            const auto r = glm::normalize(directions[first + i]);
+            for (int axis = 0; axis < 3; ++axis) {
+                voxel[axis][i] = static_cast<int>(std::floor(o[axis]));
+                SetupAxis(o[axis], r[axis], voxel[axis][i], step[axis][i], t_delta[axis][i], t_max[axis][i]);
+            }
+            auto &result = results[first + i];
+            result = RaycastResult();
+            result.voxel_x = voxel[0][i];
+            result.voxel_y = voxel[1][i];
+            result.voxel_z = voxel[2][i];
+            result.started_in_bounds = in_bounds(voxel[0][i], voxel[1][i], voxel[2][i]);
+        }
+
+        while (active_count) {
+            for (int i = 0; i < RAY_LANES; ++i) {
+                const bool x = t_max[0][i] <= t_max[1][i] && t_max[0][i] <= t_max[2][i];
+                const bool y = !x && t_max[1][i] <= t_max[2][i];
+                const bool z = !x && !y;
+                t[i] = x ? t_max[0][i] : (y ? t_max[1][i] : t_max[2][i]);
+                stepped_axis[i] = x ? 0 : (y ? 1 : 2);
+                voxel[0][i] += x ? step[0][i] : 0;
+                voxel[1][i] += y ? step[1][i] : 0;
+                voxel[2][i] += z ? step[2][i] : 0;
+                t_max[0][i] += x ? t_delta[0][i] : 0.0f;
+                t_max[1][i] += y ? t_delta[1][i] : 0.0f;
+                t_max[2][i] += z ? t_delta[2][i] : 0.0f;
+            }
+
+            for (int i = 0; i < RAY_LANES; ++i) {
+                if (!active[i])
+                    continue;
+                auto &result = results[first + i];
+                const bool finished = !(t[i] < RAYCAST_MAX_DISTANCE)
+                    || (result.started_in_bounds && !in_bounds(voxel[0][i], voxel[1][i], voxel[2][i]));
+                if (!finished) {
+                    const auto axis = stepped_axis[i];
+                    result.hit_face = ENTERED_FACE[axis][step[axis][i] > 0];
+                    result.distance = t[i];
+
+                    int lane_voxel[3], lane_step[3];
+                    float lane_t_delta[3], lane_t_max[3];
+                    for (int a = 0; a < 3; ++a) {
+                        lane_voxel[a] = voxel[a][i];
+                        lane_step[a] = step[a][i];
+                        lane_t_delta[a] = t_delta[a][i];
+                        lane_t_max[a] = t_max[a][i];
+                    }
+                    result.hit = _trace_voxel(lane_voxel, lane_step, lane_t_delta, lane_t_max, RAYCAST_MAX_DISTANCE);
+                    for (int a = 0; a < 3; ++a) {
+                        voxel[a][i] = lane_voxel[a];
+                        t_max[a][i] = lane_t_max[a];
+                    }
+                    result.voxel_x = voxel[0][i];
+                    result.voxel_y = voxel[1][i];
+                    result.voxel_z = voxel[2][i];
+                }
+                if (finished || result.hit) {
+                    active[i] = false;
+                    --active_count;
+                }
+            }
+        }
+    }
+}
@@ -2,10 +2,15 @@
 #define OPENGLTUTORIAL_VOXELGRID_HPP
 
 #include <vector>
-#include <cstring>
+#include <cstdint>
 #include <bitset>
-#include <tuple>
+#include <functional>
+#include <limits>
+#include <span>
+#include <glm/common.hpp>
 #include <glm/vec3.hpp>
+#include "ChunkLayout.hpp"
+#include "ChunkMap.hpp"
 
 
 struct Voxel
@@ -13,6 +18,8 @@ struct Voxel
     unsigned block_id;
 };
 
+struct VoxelRegion;
+
 enum class VoxelFace: unsigned { BACK, FRONT, LEFT, RIGHT, BOTTOM, TOP };
 struct RaycastResult
 {
@@ -26,79 +33,374 @@ struct RaycastResult
 
 class VoxelGrid
 {
-    struct Chunk
+public:
+    // Chunk storing its voxels as indices into a palette of distinct voxels, bit-packed with 1, 2, 4, 8 or 16 bits
+    // per voxel depending on the palette size. A chunk made of a single block keeps no indices at all.
+    // Occupancy is tracked on two levels: the number of solid voxels and a bitmask of 4x4x4 bricks with any of them.
+    class Chunk
     {
-        static constexpr int SIZE = 16;
+    public:
+        static constexpr int SIZE_LOG2 = 4;
+        static constexpr int SIZE = 1 << SIZE_LOG2;
+        static constexpr int VOLUME = SIZE * SIZE * SIZE;
+        static constexpr int BRICK_SIZE_LOG2 = 2;
+        static constexpr int BRICK_SIZE = 1 << BRICK_SIZE_LOG2;
+        using Layout = ChunkLayout<SIZE_LOG2>;
+
+    private:
+        std::vector<Voxel> _palette;
+        std::vector<std::uint16_t> _counts;
+        std::vector<std::uint64_t> _indices;
+        unsigned _bits = 0;
+        Voxel _single = {0};
+        std::uint16_t _solid_count = 0;
+        std::uint64_t _brick_mask = 0;
+
+        static unsigned _offset(unsigned x, unsigned y, unsigned z)
+        { return Layout::Offset(x, y, z); }
+
+        static unsigned _brick(unsigned x, unsigned y, unsigned z)
+        {
+            constexpr int BRICKS = SIZE / BRICK_SIZE;
+            return ((x >> BRICK_SIZE_LOG2) * BRICKS + (y >> BRICK_SIZE_LOG2)) * BRICKS + (z >> BRICK_SIZE_LOG2);
+        }
+
+        unsigned _get_index(unsigned offset) const
+        {
+            const auto bit = offset * _bits;
+            return (_indices[bit / 64] >> (bit % 64)) & ((1u << _bits) - 1);
+        }
+
+        void _put_index(unsigned offset, unsigned index)
+        {
+            const auto bit = offset * _bits;
+            const auto mask = static_cast<std::uint64_t>((1u << _bits) - 1) << (bit % 64);
+            auto &word = _indices[bit / 64];
+            word = (word & ~mask) | (static_cast<std::uint64_t>(index) << (bit % 64));
+        }
 
-        Voxel data[SIZE * SIZE * SIZE];
+        static bool _whole(glm::ivec3 lo, glm::ivec3 hi) noexcept
+        { return lo == glm::ivec3(0) && hi == glm::ivec3(SIZE - 1); }
 
-        Chunk() { std::memset(data, 0, sizeof(data)); }
+        void _make_paletted();
+        unsigned _palette_slot(Voxel voxel);
+        void _repack(unsigned bits);
+        void _update_occupancy(unsigned x, unsigned y, unsigned z, bool was_solid, bool is_solid);
+        // Writes the palette index into length consecutive voxels a word at a time, returns whether any changed
+        bool _fill_run(unsigned offset, unsigned length, unsigned index);
+        void _refresh_bricks(glm::ivec3 lo, glm::ivec3 hi);
 
-        const Voxel &operator()(unsigned x, unsigned y, unsigned z) const
+    public:
+        Voxel operator()(unsigned x, unsigned y, unsigned z) const
         {
-            return data[(x * SIZE + y) * SIZE + z];
+            if (!_bits)
+                return _single;
+            return _palette[_get_index(_offset(x, y, z))];
         }
 
-        Voxel &operator()(unsigned x, unsigned y, unsigned z)
+        // Returns whether the voxel has changed
+        bool set(unsigned x, unsigned y, unsigned z, Voxel voxel);
+        void fill(Voxel voxel);
+        void compact();
+
+        // Operations on the box with inclusive local corners lo and hi, returning whether any voxel changed
+        bool fill_box(glm::ivec3 lo, glm::ivec3 hi, Voxel voxel);
+        bool replace_in_box(glm::ivec3 lo, glm::ivec3 hi, Voxel from, Voxel to);
+        // Copies the box from source, where its low corner is at source_lo
+        bool copy_box(const Chunk &source, glm::ivec3 source_lo, glm::ivec3 lo, glm::ivec3 hi);
+
+        bool is_uniform() const noexcept
+        { return _bits == 0; }
+
+        bool empty() const noexcept
+        { return _solid_count == 0; }
+
+        unsigned solid_count() const noexcept
+        { return _solid_count; }
+
+        bool brick_occupied(unsigned x, unsigned y, unsigned z) const noexcept
+        { return (_brick_mask >> _brick(x, y, z)) & 1; }
+
+        unsigned bits_per_voxel() const noexcept
+        { return _bits; }
+
+        std::size_t memory_usage() const noexcept;
+
+        // Binary form with the bits per voxel, the palette and the packed indices, in native byte order
+        std::size_t serialized_size() const noexcept;
+        void serialize(std::byte *out) const;
+        // Returns false and leaves the chunk filled with air if data is not a serialized chunk
+        bool deserialize(std::span<const std::byte> data);
+    };
+
+    using ChunkCallback = std::function<void(glm::ivec3 chunk_pos, Chunk &chunk)>;
+
+    // Writes made while a batch exists are published to the dirty set together when the last batch ends, and
+    // count as a single change of generation()
+    class EditBatch
+    {
+        VoxelGrid &_grid;
+
+    public:
+        explicit EditBatch(VoxelGrid &grid) :
+            _grid(grid)
+        { ++_grid._batch_depth; }
+
+        EditBatch(const EditBatch &other) = delete;
+        EditBatch &operator=(const EditBatch &other) = delete;
+
+        ~EditBatch()
+        { _grid._end_batch(); }
+    };
+
+    struct ChunkEntry
+    {
+        glm::ivec3 position;
+        const Chunk &chunk;
+    };
+
+    class NonEmptyChunkIterator
+    {
+        friend class VoxelGrid;
+        const VoxelGrid *_grid;
+        std::size_t _index;
+
+        NonEmptyChunkIterator(const VoxelGrid *grid, std::size_t index) :
+            _grid(grid),
+            _index(index)
+        { _skip_empty(); }
+
+        void _skip_empty();
+
+    public:
+        ChunkEntry operator*() const;
+
+        NonEmptyChunkIterator &operator++()
         {
-            return data[(x * SIZE + y) * SIZE + z];
+            ++_index;
+            _skip_empty();
+            return *this;
         }
+
+        bool operator==(const NonEmptyChunkIterator &other) const = default;
+    };
+
+    struct NonEmptyChunks
+    {
+        NonEmptyChunkIterator first, last;
+
+        NonEmptyChunkIterator begin() const
+        { return first; }
+
+        NonEmptyChunkIterator end() const
+        { return last; }
     };
 
+private:
+    struct Location
+    {
+        glm::ivec3 chunk_pos;
+        unsigned dx, dy, dz;
+    };
+
+    // Bounded grids keep every chunk of their box in _chunks, unbounded ones only the loaded chunks in _chunk_map
+    bool _bounded = true;
     std::vector<Chunk> _chunks;
-    int _x_chunks, _y_chunks, _z_chunks;
-    int _x0, _y0, _z0;
+    ChunkMap<Chunk> _chunk_map;
+    int _x_chunks = 0, _y_chunks = 0, _z_chunks = 0;
+    int _x0 = 0, _y0 = 0, _z0 = 0;
+
+    // Chunks whose content (or a neighbour's border voxel) changed since the last drain_dirty_chunks()
+    ChunkMap<bool> _dirty, _pending_dirty;
+    std::uint64_t _generation = 0;
+    unsigned _batch_depth = 0;
+
+    ChunkCallback _chunk_loader, _chunk_unloader;
+    bool _streamed = false;
+    glm::ivec3 _stream_center;
+    int _stream_radius = 0;
+
+    // Chunks are enumerated by slots: indices of _chunks in bounded grids and hash slots in unbounded ones
+    std::size_t _chunk_slots() const noexcept
+    { return _bounded ? _chunks.size() : _chunk_map.capacity(); }
+
+    const Chunk *_chunk_in_slot(std::size_t slot, glm::ivec3 &chunk_pos) const;
+
+    // Marks the chunk and its neighbours touching the voxel at local position, or all of them if local is nullptr
+    void _mark_dirty(glm::ivec3 chunk_pos, const unsigned *local);
+    void _end_batch();
+
+    // Returns whether the voxel is solid. If it is not and lies in an empty chunk or brick, moves the DDA state to
+    // the last voxel the ray enters inside of that cell before max_distance, so the next step leaves the cell.
+    bool _trace_voxel(int voxel[3], const int step[3], const float t_delta[3], float t_max[3],
+                      float max_distance) const;
+
+    Location _locate(int x, int y, int z) const
+    {
+        const int rx = x - _x0, ry = y - _y0, rz = z - _z0;
+        return {{rx >> Chunk::SIZE_LOG2, ry >> Chunk::SIZE_LOG2, rz >> Chunk::SIZE_LOG2},
+                static_cast<unsigned>(rx & (Chunk::SIZE - 1)),
+                static_cast<unsigned>(ry & (Chunk::SIZE - 1)),
+                static_cast<unsigned>(rz & (Chunk::SIZE - 1))};
+    }
+
+    // Calls function(chunk_pos, local_lo, local_hi) for every chunk position overlapping the box, clipped to bounds
+    template<class Function>
+    void _for_each_chunk_in_box(glm::ivec3 lo, glm::ivec3 hi, Function &&function) const;
+
+    // Copies the box of the given size from source at source_lo to target at target_lo
+    static void _copy_box(const VoxelGrid &source, glm::ivec3 source_lo, VoxelGrid &target, glm::ivec3 target_lo,
+                          glm::ivec3 size);
 
-    std::tuple<unsigned, unsigned, unsigned, unsigned> _chunk_index(int x, int y, int z) const
+    Chunk *_chunk_for_write(glm::ivec3 chunk_pos)
     {
-        unsigned xx = (x - _x0) / Chunk::SIZE;
-        unsigned dx = (x - _x0) % Chunk::SIZE;
-        unsigned yy = (y - _y0) / Chunk::SIZE;
-        unsigned dy = (y - _y0) % Chunk::SIZE;
-        unsigned zz = (z - _z0) / Chunk::SIZE;
-        unsigned dz = (z - _z0) % Chunk::SIZE;
-        return {(xx * _y_chunks + yy) * _z_chunks + zz, dx, dy, dz};
+        if (!_bounded)
+            return &_chunk_map[chunk_pos];
+        return const_cast<Chunk *>(find_chunk(chunk_pos));
     }
 
     bool _contains_voxel(int x, int y, int z) const
     {
-        if (x < min_x() || y < min_y() || z < min_z() || x >= max_x() || y > max_y() || z > max_z())
-            return false;
-        auto [idx, dx, dy, dz] = _chunk_index(x, y, z);
-        return _chunks[idx](dx, dy, dz).block_id != 0;
+        auto [chunk_pos, dx, dy, dz] = _locate(x, y, z);
+        auto chunk = find_chunk(chunk_pos);
+        return chunk && (*chunk)(dx, dy, dz).block_id != 0;
     }
 
 public:
     VoxelGrid() = default;
     VoxelGrid(unsigned width, unsigned height, unsigned depth, int x0=0, int y0=0, int z0=0);
 
-    const Voxel &operator()(int x, int y, int z) const
+    static VoxelGrid Unbounded();
+
+    bool bounded() const noexcept
+    { return _bounded; }
+
+    Voxel operator()(int x, int y, int z) const
     {
-        auto [idx, dx, dy, dz] = _chunk_index(x, y, z);
-        return _chunks[idx](dx, dy, dz);
+        auto [chunk_pos, dx, dy, dz] = _locate(x, y, z);
+        auto chunk = find_chunk(chunk_pos);
+        return chunk ? (*chunk)(dx, dy, dz) : Voxel{0};
     }
 
-    Voxel &operator()(int x, int y, int z)
+    // Writes outside of a bounded grid are ignored, in an unbounded grid they create the chunk
+    void set(int x, int y, int z, Voxel voxel)
     {
-        auto [idx, dx, dy, dz] = _chunk_index(x, y, z);
-        return _chunks[idx](dx, dy, dz);
+        auto [chunk_pos, dx, dy, dz] = _locate(x, y, z);
+        if (!_bounded && voxel.block_id == 0 && !find_chunk(chunk_pos))
+            return;
+        auto chunk = _chunk_for_write(chunk_pos);
+        const unsigned local[3] = {dx, dy, dz};
+        if (chunk && chunk->set(dx, dy, dz, voxel))
+            _mark_dirty(chunk_pos, local);
     }
 
+    // Replaces the whole chunk, ignored outside of a bounded grid
+    void put_chunk(glm::ivec3 chunk_pos, Chunk chunk);
+
+    // Bulk edits of the box with inclusive corners lo and hi. They work on the part of the box inside each chunk at
+    // once and replace or copy whole chunks where the box covers them.
+    void fill_box(glm::ivec3 lo, glm::ivec3 hi, Voxel voxel);
+    void replace_in_box(glm::ivec3 lo, glm::ivec3 hi, Voxel from, Voxel to);
+    VoxelRegion copy_region(glm::ivec3 lo, glm::ivec3 hi) const;
+    // Places the low corner of the region at lo
+    void paste_region(const VoxelRegion &region, glm::ivec3 lo);
+
+    [[nodiscard]] EditBatch edit_batch()
+    { return EditBatch(*this); }
+
+    // Incremented on every change, or once per edit batch
+    std::uint64_t generation() const noexcept
+    { return _generation; }
+
+    // Returns and forgets positions of chunks changed since the last call, including chunks loaded or evicted by
+    // stream() and neighbours of chunks whose border voxels changed
+    std::vector<glm::ivec3> drain_dirty_chunks();
+
+    std::size_t memory_usage() const noexcept;
+
     std::bitset<6> faces_visibility(int x, int y, int z);
 
-    int min_x() const { return _x0; }
-    int max_x() const { return _x0 + Chunk::SIZE * _x_chunks - 1; }
-    int min_y() const { return _y0; }
-    int max_y() const { return _y0 + Chunk::SIZE * _y_chunks - 1; }
-    int min_z() const { return _z0; }
-    int max_z() const { return _z0 + Chunk::SIZE * _z_chunks - 1; }
+    bool is_solid(int x, int y, int z) const
+    { return _contains_voxel(x, y, z); }
 
-    bool in_bounds(int x, int y, int z)
+    const Chunk *find_chunk(glm::ivec3 chunk_pos) const
     {
-        return min_x() <= x && x < max_x() && min_y() <= y && y < max_y() && min_z() <= z && z < max_z();
+        if (!_bounded)
+            return _chunk_map.find(chunk_pos);
+        if (chunk_pos.x < 0 || chunk_pos.y < 0 || chunk_pos.z < 0
+                || chunk_pos.x >= _x_chunks || chunk_pos.y >= _y_chunks || chunk_pos.z >= _z_chunks)
+            return nullptr;
+        return &_chunks[(chunk_pos.x * _y_chunks + chunk_pos.y) * _z_chunks + chunk_pos.z];
     }
 
-    RaycastResult raycast(glm::vec3 o, glm::vec3 r);
+    std::size_t chunk_count() const noexcept
+    { return _bounded ? _chunks.size() : _chunk_map.size(); }
+
+    NonEmptyChunks non_empty_chunks() const
+    { return {NonEmptyChunkIterator(this, 0), NonEmptyChunkIterator(this, _chunk_slots())}; }
+
+    // Calls function(chunk_pos, chunk) for every existing chunk
+    template<class Function>
+    void for_each_chunk(Function &&function) const
+    {
+        if (!_bounded) {
+            _chunk_map.for_each(function);
+            return;
+        }
+        for (int x = 0; x < _x_chunks; ++x) {
+            for (int y = 0; y < _y_chunks; ++y) {
+                for (int z = 0; z < _z_chunks; ++z)
+                    function(glm::ivec3(x, y, z), _chunks[(x * _y_chunks + y) * _z_chunks + z]);
+            }
+        }
+    }
+
+    glm::ivec3 chunk_origin(glm::ivec3 chunk_pos) const
+    { return {_x0 + chunk_pos.x * Chunk::SIZE, _y0 + chunk_pos.y * Chunk::SIZE, _z0 + chunk_pos.z * Chunk::SIZE}; }
+
+    glm::ivec3 chunk_of(int x, int y, int z) const
+    { return _locate(x, y, z).chunk_pos; }
+
+    // The loader fills chunks entering the view radius of stream(), the unloader sees chunks right before they are
+    // evicted. Neither of them may add chunks to the grid.
+    void set_chunk_loader(ChunkCallback loader)
+    { _chunk_loader = std::move(loader); }
+
+    void set_chunk_unloader(ChunkCallback unloader)
+    { _chunk_unloader = std::move(unloader); }
+
+    void stream(glm::vec3 center, int view_radius);
+
+    // Chunk the last stream() was centered on
+    glm::ivec3 stream_center() const noexcept
+    { return _stream_center; }
+
+    int min_x() const { return _bounded ? _x0 : std::numeric_limits<int>::min(); }
+    int max_x() const { return _bounded ? _x0 + Chunk::SIZE * _x_chunks - 1 : std::numeric_limits<int>::max(); }
+    int min_y() const { return _bounded ? _y0 : std::numeric_limits<int>::min(); }
+    int max_y() const { return _bounded ? _y0 + Chunk::SIZE * _y_chunks - 1 : std::numeric_limits<int>::max(); }
+    int min_z() const { return _bounded ? _z0 : std::numeric_limits<int>::min(); }
+    int max_z() const { return _bounded ? _z0 + Chunk::SIZE * _z_chunks - 1 : std::numeric_limits<int>::max(); }
+
+    bool in_bounds(int x, int y, int z) const
+    {
+        if (!_bounded)
+            return true;
+        return min_x() <= x && x <= max_x() && min_y() <= y && y <= max_y() && min_z() <= z && z <= max_z();
+    }
+
+    // Walks the voxels pierced by the ray (exact grid traversal) up to 32 units, stopping at the first solid voxel
+    RaycastResult raycast(glm::vec3 o, glm::vec3 r) const;
+    void raycast_batch(std::span<const glm::vec3> origins, std::span<const glm::vec3> directions,
+                       std::span<RaycastResult> results) const;
+};
+
+
+// Voxels copied out of a box of a grid, kept in a bounded grid with the low corner of the box at its origin
+struct VoxelRegion
+{
+    glm::ivec3 size;
+    VoxelGrid voxels;
 };
 
 
@@ -0,0 +1,536 @@
+#include <algorithm>
+#include <cmath>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include "WorldRenderer.hpp"
+#include "AssetsRegister.hpp"
+#include "JobSystem.hpp"
+#include "GL/Debug.hpp"
+#include "GL/State.hpp"
+
+namespace {
+
+// Offsets of the neighbour chunks in the face order of ChunkMesher
+constexpr int FACE_NEIGHBOURS[6][3] = {{0, 0, -1}, {0, 0, 1}, {-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}};
+
+// Vertices of the unit cube, in the format of chunk meshes
+void PointVertexAttributes()
+{
+    static_assert(sizeof(ChunkMesh::Vertex) == 2 * sizeof(GLuint));
+    glVertexAttribIPointer(0, 2, GL_UNSIGNED_INT, sizeof(ChunkMesh::Vertex), (void*)0);
+    glEnableVertexAttribArray(0);
+}
+
+// Per-instance attributes starting at the given instance of the bound buffer; OpenGL 3.3 has no base instance for
+// instanced draws, so every section points the attributes at its own range
+void PointInstanceAttributes(GLint first_instance)
+{
+    using Instance = ChunkInstances::Instance;
+    const auto base = static_cast<std::size_t>(first_instance) * sizeof(Instance);
+    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(base + offsetof(Instance, position)));
+    glVertexAttribIPointer(5, 1, GL_INT, sizeof(Instance), (void*)(base + offsetof(Instance, block_id)));
+    glVertexAttribIPointer(6, 1, GL_INT, sizeof(Instance), (void*)(base + offsetof(Instance, face_mask)));
+}
+
+}
+
+
+WorldRenderer::WorldRenderer(const VoxelGrid &grid) :
+    _grid(grid)
+{
+    invalidate_all();
+}
+
+WorldRenderer::~WorldRenderer()
+{
+    release();
+}
+
+void WorldRenderer::set_greedy_meshing(bool greedy)
+{
+    if (_greedy_meshing == greedy)
+        return;
+    _greedy_meshing = greedy;
+    invalidate_all();
+}
+
+void WorldRenderer::set_lod_focal_length(float focal_length)
+{
+    _focal_length = focal_length;
+}
+
+void WorldRenderer::set_instanced(bool instanced)
+{
+    if (_instanced == instanced)
+        return;
+    _instanced = instanced;
+    // Buffers of one mode cannot be reused by the other
+    release();
+    invalidate_all();
+}
+
+void WorldRenderer::set_occlusion_culling(bool enabled)
+{
+    _occlusion_culling = enabled;
+    _forget_occlusion();
+}
+
+void WorldRenderer::_forget_occlusion() noexcept
+{
+    for (auto &[key, buffers]: _meshes) {
+        buffers.occluded = false;
+        buffers.query_outdated = buffers.query_pending;
+    }
+}
+
+void WorldRenderer::invalidate_all()
+{
+    for (const auto [chunk_pos, chunk]: _grid.non_empty_chunks())
+        _stale.insert(_key(chunk_pos));
+    // Meshes of chunks that are gone from the grid get rebuilt empty, which releases them
+    for (const auto &[key, buffers]: _meshes)
+        _stale.insert(key);
+}
+
+void WorldRenderer::invalidate_chunk(glm::ivec3 chunk_pos)
+{
+    _stale.insert(_key(chunk_pos));
+}
+
+void WorldRenderer::update(const AssetsRegister &assets, glm::vec3 camera_position)
+{
+    _camera_position = camera_position;
+    MeshResult result;
+    while (_results.pop(result)) {
+        auto it = _pending.find(result.key);
+        if (it == _pending.end() || it->second != result.version)
+            continue;
+        _pending.erase(it);
+        if (_instanced)
+            _upload(result.key, result.instances);
+        else
+            _upload(result.key, std::move(result.mesh), result.lod);
+    }
+
+    if (!_instanced && _focal_length > 0) {
+        for (const auto &[key, buffers]: _meshes) {
+            const glm::ivec3 chunk_pos(std::get<0>(key), std::get<1>(key), std::get<2>(key));
+            if (!_pending.contains(key) && _lod_for(chunk_pos, buffers.lod) != buffers.lod)
+                _stale.insert(key);
+        }
+    }
+
+    if (_stale.empty())
+        return;
+    // Uploads below mark neighbours stale for the next update
+    const auto stale = std::move(_stale);
+    _stale.clear();
+    for (const auto &key: stale) {
+        const glm::ivec3 chunk_pos(std::get<0>(key), std::get<1>(key), std::get<2>(key));
+        // Voxels are copied out on this thread, so the workers never read the grid while it is being edited
+        ChunkMesher mesher(assets, _greedy_meshing);
+        mesher.gather(_grid, chunk_pos);
+        const auto current = _meshes.find(key);
+        const int lod = _instanced ? 0 : _lod_for(chunk_pos, current != _meshes.end() ? current->second.lod : -1);
+        const auto neighbour_lods = _neighbour_lods(chunk_pos);
+        if (!_jobs) {
+            _pending.erase(key);
+            if (_instanced)
+                _upload(key, mesher.build_instances());
+            else
+                _upload(key, mesher.build(lod, neighbour_lods), lod);
+            continue;
+        }
+
+        const auto version = _next_version++;
+        _pending[key] = version;
+        const auto center = glm::vec3(_grid.chunk_origin(chunk_pos)) + 0.5f * VoxelGrid::Chunk::SIZE;
+        const auto distance = glm::length(center - camera_position);
+        _jobs->submit([this, key, version, lod, neighbour_lods, instanced = _instanced, mesher = std::move(mesher)]() {
+            if (instanced)
+                _results.push({key, version, lod, {}, mesher.build_instances()});
+            else
+                _results.push({key, version, lod, mesher.build(lod, neighbour_lods), {}});
+        }, distance);
+    }
+}
+
+int WorldRenderer::_lod_for(glm::ivec3 chunk_pos, int current) const
+{
+    if (_focal_length <= 0)
+        return 0;
+    const auto lo = glm::vec3(_grid.chunk_origin(chunk_pos));
+    const auto hi = lo + float(VoxelGrid::Chunk::SIZE);
+    const auto distance = glm::distance(glm::clamp(_camera_position, lo, hi), _camera_position);
+    // A cell of 2^lod voxels at this distance spans 2^lod * focal_length / distance pixels
+    const auto level = std::log2(std::max(distance, 1.0f) * LOD_CELL_PIXELS / _focal_length);
+    if (current >= 0 && std::floor(level - LOD_HYSTERESIS) <= current && current <= std::floor(level + LOD_HYSTERESIS))
+        return current;
+    return std::clamp(static_cast<int>(std::floor(level)), 0, ChunkMesher::MAX_LOD);
+}
+
+ChunkMesher::NeighbourLods WorldRenderer::_neighbour_lods(glm::ivec3 chunk_pos) const
+{
+    auto lods = ChunkMesher::NO_NEIGHBOUR_LODS;
+    for (int face = 0; face < 6; ++face) {
+        const auto &offset = FACE_NEIGHBOURS[face];
+        auto it = _meshes.find(_key(chunk_pos + glm::ivec3(offset[0], offset[1], offset[2])));
+        if (it != _meshes.end())
+            lods[face] = it->second.lod;
+    }
+    return lods;
+}
+
+void WorldRenderer::_lod_changed(glm::ivec3 chunk_pos, int old_lod, int new_lod)
+{
+    if (old_lod == new_lod)
+        return;
+    for (const auto &offset: FACE_NEIGHBOURS) {
+        const auto key = _key(chunk_pos + glm::ivec3(offset[0], offset[1], offset[2]));
+        auto it = _meshes.find(key);
+        if (it == _meshes.end())
+            continue;
+        // A chunk without a mesh counts as being at the level of the neighbour
+        const int lod = it->second.lod;
+        if ((old_lod < 0 ? lod : old_lod) != (new_lod < 0 ? lod : new_lod))
+            _stale.insert(key);
+    }
+}
+
+void WorldRenderer::_erase(ChunkKey key) noexcept
+{
+    auto it = _meshes.find(key);
+    if (it == _meshes.end())
+        return;
+    _delete(it->second);
+    _meshes.erase(it);
+    _boxes_stale = true;
+}
+
+void WorldRenderer::_upload(ChunkKey key, ChunkMesh mesh, int lod)
+{
+    const glm::ivec3 chunk_pos(std::get<0>(key), std::get<1>(key), std::get<2>(key));
+    const auto current = _meshes.find(key);
+    _lod_changed(chunk_pos, current != _meshes.end() ? current->second.lod : -1, mesh.empty() ? -1 : lod);
+    if (mesh.empty()) {
+        _erase(key);
+        return;
+    }
+
+    auto &buffers = _meshes[key];
+    if (buffers.mesh != MeshArena::NONE)
+        _arena.free(buffers.mesh);
+    buffers.mesh = _arena.allocate(static_cast<GLsizei>(mesh.vertices.size()),
+                                   static_cast<GLsizei>(mesh.indices.size()));
+    for (auto &vertex: mesh.vertices)
+        vertex.chunk_slot = static_cast<GLushort>(buffers.mesh);
+    _arena.upload(buffers.mesh, mesh.vertices, mesh.indices);
+
+    buffers.origin = _grid.chunk_origin(chunk_pos);
+    _set_origin(buffers.mesh, buffers.origin);
+    buffers.lod = lod;
+    buffers.sections = std::move(mesh.sections);
+    auto box_lo = mesh.vertices[0].position(), box_hi = box_lo;
+    for (const auto &vertex: mesh.vertices) {
+        box_lo = glm::min(box_lo, vertex.position());
+        box_hi = glm::max(box_hi, vertex.position());
+    }
+    buffers.box_lo = glm::vec3(buffers.origin + box_lo);
+    buffers.box_hi = glm::vec3(buffers.origin + box_hi);
+    _boxes_stale = true;
+}
+
+void WorldRenderer::_set_origin(MeshArena::Handle handle, glm::ivec3 origin)
+{
+    if (!_origin_buffer) {
+        glGenBuffers(1, &_origin_buffer);
+        glGenTextures(1, &_origin_table);
+        GL::State::Current().bind_texture(0, GL_TEXTURE_BUFFER, _origin_table);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, _origin_buffer);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, _origin_buffer);
+    if (handle >= _origins.size()) {
+        _origins.resize(std::max<std::size_t>({64, 2 * _origins.size(), handle + 1}));
+        _origins[handle] = glm::ivec4(origin, 0);
+        glBufferData(GL_TEXTURE_BUFFER, _origins.size() * sizeof(glm::ivec4), _origins.data(), GL_DYNAMIC_DRAW);
+    } else {
+        _origins[handle] = glm::ivec4(origin, 0);
+        glBufferSubData(GL_TEXTURE_BUFFER, handle * sizeof(glm::ivec4), sizeof(glm::ivec4), &_origins[handle]);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    GL::GLError::RaiseIfError();
+}
+
+void WorldRenderer::_upload(ChunkKey key, const ChunkInstances &instances)
+{
+    if (instances.empty()) {
+        _erase(key);
+        return;
+    }
+
+    _create_cube();
+    auto &buffers = _meshes[key];
+    if (!buffers.vao) {
+        glGenVertexArrays(1, &buffers.vao);
+        GL::State::Current().bind_vertex_array(buffers.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, _cube_vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _cube_ebo);
+        PointVertexAttributes();
+
+        glGenBuffers(1, &buffers.vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.vbo);
+        for (GLuint attribute = 4; attribute <= 6; ++attribute) {
+            glEnableVertexAttribArray(attribute);
+            glVertexAttribDivisor(attribute, 1);
+        }
+    } else {
+        GL::State::Current().bind_vertex_array(buffers.vao);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.vbo);
+    }
+
+    glBufferData(GL_ARRAY_BUFFER, instances.instances.size() * sizeof(ChunkInstances::Instance),
+                 instances.instances.data(), GL_STATIC_DRAW);
+    GL::State::Current().bind_vertex_array(0);
+    GL::GLError::RaiseIfError();
+
+    buffers.origin = _grid.chunk_origin({std::get<0>(key), std::get<1>(key), std::get<2>(key)});
+    buffers.instance_sections = instances.sections;
+    buffers.box_lo = buffers.box_hi = instances.instances[0].position;
+    for (const auto &instance: instances.instances) {
+        buffers.box_lo = glm::min(buffers.box_lo, instance.position);
+        buffers.box_hi = glm::max(buffers.box_hi, instance.position);
+    }
+    buffers.box_lo += glm::vec3(buffers.origin);
+    buffers.box_hi += glm::vec3(buffers.origin) + 1.0f;
+    _boxes_stale = true;
+}
+
+void WorldRenderer::_create_cube()
+{
+    if (_cube_vbo)
+        return;
+    // The element buffer binding would otherwise end up in whatever vertex array is bound
+    GL::State::Current().bind_vertex_array(0);
+    const auto cube = ChunkMesher::UnitCube();
+    glGenBuffers(1, &_cube_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, _cube_vbo);
+    glBufferData(GL_ARRAY_BUFFER, cube.vertices.size() * sizeof(ChunkMesh::Vertex), cube.vertices.data(),
+                 GL_STATIC_DRAW);
+    glGenBuffers(1, &_cube_ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _cube_ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, cube.indices.size() * sizeof(GLuint), cube.indices.data(),
+                 GL_STATIC_DRAW);
+    _cube_index_count = static_cast<GLsizei>(cube.indices.size());
+}
+
+void WorldRenderer::draw(GL::ShaderProgram &shader, const AssetsRegister &assets, const Frustum &frustum)
+{
+    GL::DebugScope scope("WorldRenderer::draw");
+    if (_boxes_stale) {
+        _boxes.clear();
+        _box_owners.clear();
+        for (auto &[key, buffers]: _meshes) {
+            _boxes.push_back(buffers.box_lo, buffers.box_hi);
+            _box_owners.push_back(&buffers);
+        }
+        _boxes_stale = false;
+    }
+    frustum.test(_boxes, _visible);
+    // Chunks hidden from where the camera was may be in plain sight from where it is now
+    if (_occlusion_culling && glm::distance(_camera_position, _queried_from) > OCCLUSION_RETEST_DISTANCE)
+        _forget_occlusion();
+
+    _draw_calls = 0;
+    _triangles = 0;
+    _culled_chunks = 0;
+    _occluded_chunks = 0;
+    auto &state = GL::State::Current();
+    auto attr_position = shader["Position"];
+    state.bind_texture(1, GL_TEXTURE_BUFFER, assets.material_table());
+    shader["MaterialTable"] = 1;
+    state.bind_texture(2, GL_TEXTURE_BUFFER, _origin_table);
+    shader["ChunkOrigins"] = 2;
+    shader["AtlasArray"] = 0;
+    for (auto &[texture_array, multi_draw]: _multi_draws) {
+        multi_draw.counts.clear();
+        multi_draw.offsets.clear();
+        multi_draw.base_vertices.clear();
+    }
+    for (std::size_t i = 0; i < _box_owners.size(); ++i) {
+        auto &buffers = *_box_owners[i];
+        if (!_visible[i]) {
+            // Occlusion measured before the chunk left the frustum says nothing about it when it comes back
+            buffers.occluded = false;
+            buffers.query_outdated = buffers.query_pending;
+            ++_culled_chunks;
+            continue;
+        }
+        if (_occlusion_culling && buffers.query_pending) {
+            // Results of the previous frame are used only once ready, waiting for them would stall the pipeline
+            GLuint available = 0;
+            glGetQueryObjectuiv(buffers.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint samples_passed = 0;
+                glGetQueryObjectuiv(buffers.query, GL_QUERY_RESULT, &samples_passed);
+                if (!buffers.query_outdated)
+                    buffers.occluded = !samples_passed;
+                buffers.query_pending = buffers.query_outdated = false;
+            }
+        }
+        if (_occlusion_culling && buffers.occluded) {
+            ++_occluded_chunks;
+            continue;
+        }
+        if (_instanced) {
+            attr_position = glm::vec3(buffers.origin);
+            _draw_instances(buffers);
+        } else {
+            _queue_mesh(buffers);
+        }
+    }
+    if (!_instanced)
+        _draw_meshes();
+    GL::GLError::RaiseIfError();
+}
+
+void WorldRenderer::draw_occlusion_queries(GL::ShaderProgram &box_shader)
+{
+    // The frustum test results are only valid for the set of meshes draw() has seen
+    if (!_occlusion_culling || _boxes_stale)
+        return;
+    GL::DebugScope scope("WorldRenderer::draw_occlusion_queries");
+    _queried_from = _camera_position;
+
+    if (!_box_vao) {
+        _create_cube();
+        glGenVertexArrays(1, &_box_vao);
+        GL::State::Current().bind_vertex_array(_box_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, _cube_vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _cube_ebo);
+        PointVertexAttributes();
+    }
+    GL::State::Current().bind_vertex_array(_box_vao);
+
+    // Back faces have to count as well, and wireframe boxes would miss samples
+    auto &state = GL::State::Current();
+    const auto cull_face = state.capability(GL_CULL_FACE);
+    const auto polygon_mode = state.polygon_mode();
+    state.set_capability(GL_CULL_FACE, false);
+    state.polygon_mode(GL_FILL);
+    state.color_mask(false);
+    state.depth_mask(false);
+
+    auto attr_position = box_shader["BoxPosition"];
+    auto attr_size = box_shader["BoxSize"];
+    for (std::size_t i = 0; i < _box_owners.size(); ++i) {
+        auto &buffers = *_box_owners[i];
+        if (!_visible[i] || buffers.query_pending)
+            continue;
+        const auto lo = buffers.box_lo - OCCLUSION_MARGIN, hi = buffers.box_hi + OCCLUSION_MARGIN;
+        // The near plane would clip away the faces of a box around the camera
+        if (_camera_position.x >= lo.x && _camera_position.y >= lo.y && _camera_position.z >= lo.z &&
+            _camera_position.x <= hi.x && _camera_position.y <= hi.y && _camera_position.z <= hi.z) {
+            buffers.occluded = false;
+            continue;
+        }
+        if (!buffers.query)
+            glGenQueries(1, &buffers.query);
+        attr_position = lo;
+        attr_size = hi - lo;
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, buffers.query);
+        glDrawElements(GL_TRIANGLES, _cube_index_count, GL_UNSIGNED_INT, nullptr);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        buffers.query_pending = true;
+        buffers.query_outdated = false;
+    }
+
+    state.depth_mask(true);
+    state.color_mask(true);
+    state.polygon_mode(polygon_mode);
+    state.set_capability(GL_CULL_FACE, cull_face);
+    GL::GLError::RaiseIfError();
+}
+
+void WorldRenderer::_queue_mesh(const ChunkBuffers &buffers)
+{
+    const auto &allocation = _arena[buffers.mesh];
+    for (const auto &section: buffers.sections) {
+        auto &multi_draw = _multi_draws[section.texture_array];
+        multi_draw.counts.push_back(section.index_count);
+        multi_draw.offsets.push_back((void*)((allocation.first_index + section.first_index) * sizeof(GLuint)));
+        multi_draw.base_vertices.push_back(allocation.first_vertex);
+    }
+}
+
+void WorldRenderer::_draw_meshes()
+{
+    // All meshes share the vertex array of the arena, each texture array takes a single draw call
+    auto &state = GL::State::Current();
+    state.bind_vertex_array(_arena.vao());
+    for (auto &[texture_array, multi_draw]: _multi_draws) {
+        if (multi_draw.counts.empty())
+            continue;
+        state.bind_texture(0, GL_TEXTURE_2D_ARRAY, texture_array);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, multi_draw.counts.data(), GL_UNSIGNED_INT,
+                                      multi_draw.offsets.data(), static_cast<GLsizei>(multi_draw.counts.size()),
+                                      multi_draw.base_vertices.data());
+        ++_draw_calls;
+        for (auto count: multi_draw.counts)
+            _triangles += count / 3;
+    }
+}
+
+void WorldRenderer::_draw_instances(const ChunkBuffers &buffers)
+{
+    auto &state = GL::State::Current();
+    state.bind_vertex_array(buffers.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.vbo);
+    for (const auto &section: buffers.instance_sections) {
+        state.bind_texture(0, GL_TEXTURE_2D_ARRAY, section.texture_array);
+        PointInstanceAttributes(section.first_instance);
+        glDrawElementsInstanced(GL_TRIANGLES, _cube_index_count, GL_UNSIGNED_INT, nullptr, section.instance_count);
+        ++_draw_calls;
+        _triangles += std::uint64_t(_cube_index_count / 3) * section.instance_count;
+    }
+}
+
+void WorldRenderer::_delete(ChunkBuffers &buffers) noexcept
+{
+    if (buffers.query)
+        glDeleteQueries(1, &buffers.query);
+    if (buffers.mesh != MeshArena::NONE)
+        _arena.free(buffers.mesh);
+    glDeleteBuffers(1, &buffers.vbo);
+    if (buffers.vao) {
+        GL::State::Current().forget_vertex_array(buffers.vao);
+        glDeleteVertexArrays(1, &buffers.vao);
+    }
+    buffers = ChunkBuffers();
+}
+
+void WorldRenderer::release() noexcept
+{
+    for (auto &[key, buffers]: _meshes)
+        _delete(buffers);
+    _meshes.clear();
+    _arena.release();
+    if (_origin_buffer) {
+        GL::State::Current().forget_texture(_origin_table);
+        glDeleteTextures(1, &_origin_table);
+        glDeleteBuffers(1, &_origin_buffer);
+        _origin_buffer = _origin_table = 0;
+    }
+    _origins.clear();
+    _pending.clear();
+    _boxes_stale = true;
+    if (_box_vao) {
+        GL::State::Current().forget_vertex_array(_box_vao);
+        glDeleteVertexArrays(1, &_box_vao);
+        _box_vao = 0;
+    }
+    if (_cube_vbo) {
+        glDeleteBuffers(1, &_cube_ebo);
+        glDeleteBuffers(1, &_cube_vbo);
+        _cube_vbo = _cube_ebo = 0;
+    }
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <set>
+#include <tuple>
+#include "GL/Shaders.hpp"
+#include "ChunkMesher.hpp"
+#include "Frustum.hpp"
+#include "MeshArena.hpp"
+#include "MpscQueue.hpp"
+#include "VoxelGrid.hpp"
+
+class JobSystem;
+
+class AssetsRegister;
+
+
+class WorldRenderer
+{
+    using ChunkKey = std::tuple<int, int, int>;
+
+    // Meshes live in the arena. In the instanced mode vbo holds the instances and the unit cube buffers are shared by
+    // all chunks.
+    struct ChunkBuffers
+    {
+        MeshArena::Handle mesh = MeshArena::NONE;
+        GLuint vao = 0, vbo = 0;
+        glm::ivec3 origin;
+        int lod = 0;
+        // World space bounds of the geometry
+        glm::vec3 box_lo, box_hi;
+        std::vector<ChunkMesh::Section> sections;
+        std::vector<ChunkInstances::Section> instance_sections;
+        // Occlusion query of the bounding box, its result is read during the next draw()
+        GLuint query = 0;
+        bool query_pending = false;
+        // Result of the pending query is measured from a position the camera has left
+        bool query_outdated = false;
+        bool occluded = false;
+    };
+
+    struct MeshResult
+    {
+        ChunkKey key;
+        std::uint64_t version;
+        int lod;
+        ChunkMesh mesh;
+        ChunkInstances instances;
+    };
+
+    // Arguments of one glMultiDrawElementsBaseVertex call
+    struct MultiDraw
+    {
+        std::vector<GLsizei> counts;
+        std::vector<void *> offsets;
+        std::vector<GLint> base_vertices;
+    };
+
+    const VoxelGrid &_grid;
+    JobSystem *_jobs = nullptr;
+    bool _greedy_meshing = true;
+    bool _instanced = false;
+    GLuint _cube_vbo = 0, _cube_ebo = 0;
+    GLsizei _cube_index_count = 0;
+    GLuint _box_vao = 0;
+    std::map<ChunkKey, ChunkBuffers> _meshes;
+    MeshArena _arena;
+    // Buffer texture (GL_RGBA32I) with the origin of every chunk by its arena handle, vertices carry the handle in
+    // chunk_slot
+    GLuint _origin_buffer = 0, _origin_table = 0;
+    std::vector<glm::ivec4> _origins;
+    // Visible mesh sections by texture array, refilled by every draw()
+    std::map<GLuint, MultiDraw> _multi_draws;
+    std::set<ChunkKey> _stale;
+    // Latest meshing job submitted for each chunk; results of older jobs finishing late are dropped
+    std::map<ChunkKey, std::uint64_t> _pending;
+    std::uint64_t _next_version = 0;
+    MpscQueue<MeshResult> _results;
+    // Bounds of _meshes in iteration order, rebuilt when the set of meshes changes
+    AabbList _boxes;
+    std::vector<ChunkBuffers *> _box_owners;
+    std::vector<std::uint8_t> _visible;
+    bool _boxes_stale = true;
+    bool _occlusion_culling = false;
+    // Distance in pixels from the eye to the screen, zero keeps every chunk at full detail
+    float _focal_length = 0;
+    glm::vec3 _camera_position{0};
+    // Camera position the occlusion results were measured from
+    glm::vec3 _queried_from{0};
+    unsigned _draw_calls = 0;
+    std::uint64_t _triangles = 0;
+    unsigned _culled_chunks = 0;
+    unsigned _occluded_chunks = 0;
+
+    static ChunkKey _key(glm::ivec3 chunk_pos)
+    { return {chunk_pos.x, chunk_pos.y, chunk_pos.z}; }
+
+    int _lod_for(glm::ivec3 chunk_pos, int current) const;
+    ChunkMesher::NeighbourLods _neighbour_lods(glm::ivec3 chunk_pos) const;
+    // Marks the neighbours whose meshes depend on the level of detail of this chunk changing from old_lod to new_lod,
+    // negative when it has no mesh
+    void _lod_changed(glm::ivec3 chunk_pos, int old_lod, int new_lod);
+    void _upload(ChunkKey key, ChunkMesh mesh, int lod);
+    void _upload(ChunkKey key, const ChunkInstances &instances);
+    void _erase(ChunkKey key) noexcept;
+    void _set_origin(MeshArena::Handle handle, glm::ivec3 origin);
+    void _queue_mesh(const ChunkBuffers &buffers);
+    void _draw_meshes();
+    void _draw_instances(const ChunkBuffers &buffers);
+    void _create_cube();
+    void _forget_occlusion() noexcept;
+    void _delete(ChunkBuffers &buffers) noexcept;
+
+public:
+    // Occlusion boxes are grown by this margin, so that they are never hidden by the chunk's own faces
+    static constexpr float OCCLUSION_MARGIN = 0.5f;
+    // Moving further than this between frames makes every chunk visible until it has been tested from the new position
+    static constexpr float OCCLUSION_RETEST_DISTANCE = 1.0f;
+    // Chunks are meshed at the coarsest level whose cells still span at most this many pixels on screen
+    static constexpr float LOD_CELL_PIXELS = 2.0f;
+    // Fraction of a level the camera has to move past a threshold before the chunk switches, so chunks on the
+    // threshold are not meshed again on every small move
+    static constexpr float LOD_HYSTERESIS = 0.2f;
+
+    explicit WorldRenderer(const VoxelGrid &grid);
+    WorldRenderer(const WorldRenderer &other) = delete;
+    ~WorldRenderer();
+
+    void set_greedy_meshing(bool greedy);
+    // Enables levels of detail for a projection with this distance in pixels from the eye to the screen, that is the
+    // viewport height divided by 2 tan(fov / 2). Instanced mode always draws full detail.
+    void set_lod_focal_length(float focal_length);
+    // Instanced mode draws every visible voxel as a cube instance instead of building chunk meshes. The shader passed
+    // to draw() must match: VoxelInstanced.vert reads the per-instance attributes.
+    void set_instanced(bool instanced);
+
+    bool instanced() const noexcept
+    { return _instanced; }
+    // With a job system meshes are built on its workers, nearest chunks first, and uploaded by a later update()
+    void set_job_system(JobSystem *jobs) noexcept
+    { _jobs = jobs; }
+
+    // Chunks whose bounding boxes were hidden in the previous frame are skipped. Boxes are tested by
+    // draw_occlusion_queries() after the voxels are drawn.
+    void set_occlusion_culling(bool enabled);
+
+    void invalidate_all();
+    void invalidate_chunk(glm::ivec3 chunk_pos);
+    void update(const AssetsRegister &assets, glm::vec3 camera_position);
+    // Draws the chunks whose bounds intersect the frustum
+    void draw(GL::ShaderProgram &shader, const AssetsRegister &assets, const Frustum &frustum);
+    // Renders the bounding boxes of chunks that passed the frustum test of the last draw() inside occlusion queries,
+    // without writing colour or depth. box_shader is OcclusionBox.vert with the view and projection already set.
+    void draw_occlusion_queries(GL::ShaderProgram &box_shader);
+    void release() noexcept;
+
+    unsigned draw_calls() const noexcept
+    { return _draw_calls; }
+
+    // Triangles submitted by the last draw(), including faces the instanced mode collapses in the vertex shader
+    std::uint64_t triangles() const noexcept
+    { return _triangles; }
+
+    // Chunks skipped by the last draw() for being outside of the frustum
+    unsigned culled_chunks() const noexcept
+    { return _culled_chunks; }
+
+    // Chunks skipped by the last draw() for being hidden behind other chunks
+    unsigned occluded_chunks() const noexcept
+    { return _occluded_chunks; }
+
+    std::size_t pending_meshes() const noexcept
+    { return _pending.size(); }
+};